@@ -0,0 +1,110 @@
+/*
+ * encode_bench.c
+ *
+ * Userspace micro-benchmark comparing the table driven encoder against the
+ * original per-bit encode loop from hal_render()
+ *
+ * usage: encode_bench [num_leds] [iterations]
+ *
+ * Aaron Reyes
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>   /* for printf() */
+#include <stdlib.h>  /* for malloc()/atoi() */
+#include <string.h>  /* for memcmp() */
+#include <time.h>    /* for clock_gettime() */
+
+#include <encoder.h> /* for the table driven encoder */
+#include <WS281x.h>  /* for WS281x_DATA_LEN */
+#include <BCM2835.h> /* for BYTES_PER_WS281x and the PWM symbols */
+
+
+/*
+ * the original per-bit encode loop used as the reference implementation
+ */
+static void encode_loop(char *kbuf, const char *buf, size_t len) {
+  size_t i, j;
+  for (i = 0, j = 0; i < len; i++, j+=BYTES_PER_WS281x) {
+    kbuf[j + 3]  = (buf[i] & (1 << 7)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
+    kbuf[j + 3] |= (buf[i] & (1 << 6)) ? WS281x_1 : WS281x_0;
+    kbuf[j + 2]  = (buf[i] & (1 << 5)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
+    kbuf[j + 2] |= (buf[i] & (1 << 4)) ? WS281x_1 : WS281x_0;
+    kbuf[j + 1]  = (buf[i] & (1 << 3)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
+    kbuf[j + 1] |= (buf[i] & (1 << 2)) ? WS281x_1 : WS281x_0;
+    kbuf[j + 0]  = (buf[i] & (1 << 1)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
+    kbuf[j + 0] |= (buf[i] & (1 << 0)) ? WS281x_1 : WS281x_0;
+  }
+}
+
+
+/*
+ * returns the current monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+
+int main(int argc, char **argv) {
+  int num_leds = (argc > 1) ? atoi(argv[1]) : 1000;
+  int iterations = (argc > 2) ? atoi(argv[2]) : 1000;
+  size_t len, i;
+  char *buf;
+  uint32_t *ref, *out;
+  double start, loop_ns, table_ns;
+  int n;
+
+  if (num_leds <= 0 || iterations <= 0) {
+    fprintf(stderr, "usage: %s [num_leds] [iterations]\n", argv[0]);
+    return 1;
+  }
+  len = num_leds * WS281x_DATA_LEN;
+  buf = malloc(len);
+  ref = malloc(len * BYTES_PER_WS281x);
+  out = malloc(len * BYTES_PER_WS281x);
+  if (!buf || !ref || !out) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  // fill the frame with every possible byte value
+  for (i = 0; i < len; i++) {
+    buf[i] = (char)(i * 7);
+  }
+  encoder_init(WS281x_1, WS281x_0, BYTES_PER_WS281x);
+
+  // make sure both encoders produce the same bit stream
+  encode_loop((char *)ref, buf, len);
+  encoder_run(out, (const uint8_t *)buf, num_leds, 1);
+  if (memcmp(ref, out, len * BYTES_PER_WS281x)) {
+    fprintf(stderr, "table encoder output does not match the reference loop\n");
+    return 1;
+  }
+
+  start = now_ns();
+  for (n = 0; n < iterations; n++) {
+    encode_loop((char *)ref, buf, len);
+    __asm__ __volatile__("" : : "r"(ref) : "memory");
+  }
+  loop_ns = (now_ns() - start) / ((double)iterations * num_leds);
+
+  start = now_ns();
+  for (n = 0; n < iterations; n++) {
+    encoder_run(out, (const uint8_t *)buf, num_leds, 1);
+    __asm__ __volatile__("" : : "r"(out) : "memory");
+  }
+  table_ns = (now_ns() - start) / ((double)iterations * num_leds);
+
+  printf("num_leds=%d iterations=%d\n", num_leds, iterations);
+  printf("loop:  %.3f ns/pixel\n", loop_ns);
+  printf("table: %.3f ns/pixel\n", table_ns);
+  printf("speedup: %.2fx\n", loop_ns / table_ns);
+
+  free(buf);
+  free(ref);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * frame_bench.c
+ *
+ * Userspace end-to-end benchmark for /dev/ws281x. Measures the maximum frame rate and the
+ * write() latency percentiles for full and partial frames, plus the encode-only time per
+ * pixel across strip lengths. Works against real hardware or the loopback platform.
+ * Results are printed as one JSON object per line.
+ *
+ * usage: frame_bench [-d device] [-n num_leds] [-f frames] [-p partial_leds] [-r] [-e]
+ *
+ * Aaron Reyes
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>   /* for printf() */
+#include <stdlib.h>  /* for malloc()/atoi()/qsort() */
+#include <string.h>  /* for strerror() */
+#include <errno.h>   /* for errno */
+#include <time.h>    /* for clock_gettime() */
+#include <fcntl.h>   /* for open() */
+#include <unistd.h>  /* for pwrite()/getopt() */
+#include <sys/ioctl.h> /* for ioctl() */
+
+#include <encoder.h> /* for the table driven encoder */
+#include <WS281x.h>  /* for DRIVER_NAME */
+#include <WS281x_ioctl.h> /* for WS281x_FMT_* */
+#include <BCM2835.h> /* for BYTES_PER_WS281x and the PWM symbols */
+
+/* strip lengths used for the encode-only measurement */
+static const int encode_leds[] = { 30, 100, 300, 1000, 3000, 10000 };
+
+/* pixel formats (pixel data, wire) used for the encode-only measurement */
+static const struct {
+  const char *name;
+  unsigned int pixel_fmt;
+  unsigned int wire_fmt;
+} encode_fmts[] = {
+  { "GRB", WS281x_FMT_GRB, WS281x_FMT_GRB },
+  { "RGB>GRB", WS281x_FMT_RGB, WS281x_FMT_GRB },
+  { "RGBW16>GRBW", WS281x_FMT_RGBW16, WS281x_FMT_GRBW },
+};
+
+
+/*
+ * returns the current monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ * returns the p'th percentile of a sorted array of samples
+ */
+static double percentile(const double *samples, int len, double p) {
+  int i = (int)(p / 100.0 * (len - 1) + 0.5);
+  return samples[i];
+}
+
+
+/*
+ * reads an integer module parameter of the driver, returns 0 if it cannot be read
+ */
+static int read_param(const char *name) {
+  char path[128];
+  FILE *f;
+  int val = 0;
+  snprintf(path, sizeof(path), "/sys/module/%s/parameters/%s", DRIVER_NAME, name);
+  f = fopen(path, "r");
+  if (f) {
+    if (fscanf(f, "%d", &val) != 1) {
+      val = 0;
+    }
+    fclose(f);
+  }
+  return val;
+}
+
+
+/*
+ * writes frames to the device and reports frame rate and write() latency
+ *
+ * fd - open device
+ * mode - name of the run in the output
+ * num_leds - total number of LEDs in a frame
+ * leds - number of LEDs written per frame starting at the first pixel
+ * pixel_len - bytes per pixel in the module's pixel format
+ * frames - number of frames to write
+ */
+static int bench_write(int fd, const char *mode, int num_leds, int leds, int pixel_len, int frames) {
+  size_t len = leds * pixel_len, i;
+  unsigned char *buf = malloc(len);
+  double *lat = malloc(frames * sizeof(double));
+  double start, t, total;
+  int n;
+
+  if (!buf || !lat) {
+    fprintf(stderr, "out of memory\n");
+    free(buf);
+    free(lat);
+    return 1;
+  }
+  start = now_ns();
+  for (n = 0; n < frames; n++) {
+    // every frame differs from the previous one so none of it is skipped as unchanged
+    for (i = 0; i < len; i++) {
+      buf[i] = (unsigned char)(n + i);
+    }
+    t = now_ns();
+    if (pwrite(fd, buf, len, 0) != (ssize_t)len) {
+      fprintf(stderr, "write failed: %s\n", strerror(errno));
+      free(buf);
+      free(lat);
+      return 1;
+    }
+    lat[n] = now_ns() - t;
+  }
+  total = now_ns() - start;
+  qsort(lat, frames, sizeof(double), cmp_double);
+  printf("{\"test\":\"write\",\"mode\":\"%s\",\"num_leds\":%d,\"leds\":%d,\"frames\":%d,"
+         "\"fps\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+         mode, num_leds, leds, frames, frames / (total / 1e9),
+         percentile(lat, frames, 50) / 1e3, percentile(lat, frames, 90) / 1e3,
+         percentile(lat, frames, 99) / 1e3, lat[frames - 1] / 1e3);
+  free(buf);
+  free(lat);
+  return 0;
+}
+
+
+/*
+ * reports the time the table driven encoder takes per pixel for a range of strip lengths in
+ * the current pixel format and symbol length
+ *
+ * name - name of the pixel format conversion in the output
+ * bits - PWM slots per data bit
+ */
+static int bench_encode_format(const char *name, int bits) {
+  size_t len, i, k;
+  uint8_t *buf;
+  uint32_t *out;
+  double start, ns;
+  int n, iterations;
+
+  for (k = 0; k < sizeof(encode_leds) / sizeof(encode_leds[0]); k++) {
+    len = encode_leds[k] * encoder_pixel_len();
+    buf = malloc(len);
+    out = malloc(encoder_words(encode_leds[k]) * sizeof(uint32_t));
+    if (!buf || !out) {
+      fprintf(stderr, "out of memory\n");
+      free(buf);
+      free(out);
+      return 1;
+    }
+    for (i = 0; i < len; i++) {
+      buf[i] = (uint8_t)(i * 7);
+    }
+    // keep the amount of work per strip length roughly constant
+    iterations = 10000000 / encode_leds[k];
+    start = now_ns();
+    for (n = 0; n < iterations; n++) {
+      encoder_run(out, buf, encode_leds[k], 1);
+      __asm__ __volatile__("" : : "r"(out) : "memory");
+    }
+    ns = (now_ns() - start) / ((double)iterations * encode_leds[k]);
+    printf("{\"test\":\"encode\",\"format\":\"%s\",\"symbol_bits\":%d,\"num_leds\":%d,\"iterations\":%d,\"ns_per_pixel\":%.3f}\n",
+           name, bits, encode_leds[k], iterations, ns);
+    free(buf);
+    free(out);
+  }
+  return 0;
+}
+
+
+/*
+ * reports the encode time per pixel for every pixel format conversion with 4 and 3 bit symbols
+ */
+static int bench_encode(void) {
+  size_t f;
+  int bits, err = 0;
+
+  for (bits = BYTES_PER_WS281x; bits >= 3 && !err; bits--) {
+    if (bits == 3) {
+      encoder_init(WS281x_1_3BIT, WS281x_0_3BIT, 3);
+    } else {
+      encoder_init(WS281x_1, WS281x_0, BYTES_PER_WS281x);
+    }
+    for (f = 0; f < sizeof(encode_fmts) / sizeof(encode_fmts[0]) && !err; f++) {
+      encoder_set_format(encode_fmts[f].pixel_fmt, encode_fmts[f].wire_fmt);
+      err = bench_encode_format(encode_fmts[f].name, bits);
+    }
+  }
+  return err;
+}
+
+
+/*
+ * lays the first strip out for num_leds LEDs on the pins already in use (the second strip is
+ * disabled). returns 0 on success.
+ */
+static int set_strip(int fd, int num_leds) {
+  struct ws281x_strip strip;
+  if (ioctl(fd, WS281x_IOC_GET_STRIP, &strip)) {
+    return -1;
+  }
+  strip.num_leds = num_leds;
+  strip.num_leds2 = 0;
+  return ioctl(fd, WS281x_IOC_SET_STRIP, &strip);
+}
+
+
+int main(int argc, char **argv) {
+  const char *device = "/dev/" DRIVER_NAME;
+  int num_leds = 0, frames = 1000, partial = 0, encode_only = 0, reconfigure = 0;
+  int fd, opt, err, pixel_len;
+
+  while ((opt = getopt(argc, argv, "d:n:f:p:re")) != -1) {
+    switch (opt) {
+      case 'd': device = optarg; break;
+      case 'n': num_leds = atoi(optarg); break;
+      case 'f': frames = atoi(optarg); break;
+      case 'p': partial = atoi(optarg); break;
+      case 'r': reconfigure = 1; break;
+      case 'e': encode_only = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-d device] [-n num_leds] [-f frames] [-p partial_leds] [-r] [-e]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (encode_only) {
+    return bench_encode();
+  }
+  // default to the strip length(s) the loaded module was configured with
+  if (!num_leds) {
+    num_leds = read_param("num_leds") + read_param("num_leds2");
+  }
+  if (num_leds <= 0 || frames <= 0 || partial < 0 || partial > num_leds) {
+    fprintf(stderr, "invalid num_leds/frames/partial_leds (is the module loaded?)\n");
+    return 1;
+  }
+  if (!partial) {
+    partial = (num_leds >= 10) ? num_leds / 10 : 1;
+  }
+  // frames are written in the pixel format the module was loaded with
+  pixel_len = encoder_format_len(read_param("pixel_format"));
+  if (!pixel_len) {
+    pixel_len = WS281x_DATA_LEN;
+  }
+
+  fd = open(device, O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", device, strerror(errno));
+    return 1;
+  }
+  // the module can be laid out for the strip length without reloading it
+  if (reconfigure && set_strip(fd, num_leds)) {
+    fprintf(stderr, "cannot set the strip to %d LEDs: %s\n", num_leds, strerror(errno));
+    close(fd);
+    return 1;
+  }
+  err = bench_write(fd, "full", num_leds, num_leds, pixel_len, frames);
+  if (!err) {
+    err = bench_write(fd, "partial", num_leds, partial, pixel_len, frames);
+  }
+  close(fd);
+  if (!err) {
+    err = bench_encode();
+  }
+  return err;
+}
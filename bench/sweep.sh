@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# sweep.sh
+#
+# Runs frame_bench for a range of strip lengths. The module is loaded once and laid out for
+# each strip length with WS281x_IOC_SET_STRIP (frame_bench -r).
+# Build the module first (make, or make PLATFORM=loopback to run without hardware).
+#
+# usage: sweep.sh [pin_num] [pin_fun] [frames]
+#
+# Aaron Reyes
+#
+
+DIR=$(dirname "$0")
+PIN_NUM=${1:-18}
+PIN_FUN=${2:-5}
+FRAMES=${3:-500}
+
+rmmod ws281x 2>/dev/null
+insmod "$DIR/../ws281x.ko" num_leds=30 pin_num=$PIN_NUM pin_fun=$PIN_FUN || exit 1
+for LEDS in 30 100 300 1000 3000 10000; do
+  "$DIR/frame_bench" -r -n "$LEDS" -f "$FRAMES"
+  RC=$?
+  [ $RC -eq 0 ] || break
+done
+rmmod ws281x
+exit $RC
@@ -9,7 +9,9 @@
 #ifndef _WS281x_H_
 #define _WS281x_H_
 
+#ifdef __KERNEL__
 #include <linux/mutex.h> /* required for the mutex functionality */
+#endif
 
 #define DRIVER_NAME    "ws281x"
 #define DRIVER_VERSION "0.1"
@@ -20,14 +22,16 @@
 /* signal rate of the pixels */
 #define WS281x_RATE 800000 // Hz
 
-/* number of bytes required to program a given pixel */
+/* number of bytes required to program a given pixel in the default pixel format */
 #define WS281x_DATA_LEN 3 // bytes (for GRB)
 
 /* number of bytes for the RESET signal (55us) */
 // takes the number of bytes used per pixel by the driver internals
 #define WS281x_RESET_PADDING(x) (((55 * (x) * WS281x_RATE) / 1000000) >> 3) // bytes
 
-/* kernel module level mutex for access */
+#ifdef __KERNEL__
+
+/* kernel module level mutex for opening and closing the device */
 extern struct mutex ws281x_mutex;
 
 /* number of WS281x LEDs currently under control */
@@ -39,4 +43,39 @@ extern int pin_num;
 /* GPIO pin alternate function to use */
 extern int pin_fun;
 
+/* number of WS281x LEDs on the optional second strip (0 to disable it) */
+extern int num_leds2;
+
+/* GPIO pin to use as output for the second strip */
+extern int pin_num2;
+
+/* GPIO pin alternate function to use for the second strip */
+extern int pin_fun2;
+
+/* interrupt number for DMA completion (0 to look it up in the device tree) */
+extern int dma_irq;
+
+/* fixed refresh rate for queued frames (0 to render frames as soon as they are written) */
+extern int refresh_hz;
+
+/* pending frame policy used with refresh_hz (WS281x_POLICY_*) */
+extern int queue_policy;
+
+/* number of frames that can be pending with refresh_hz */
+extern int queue_depth;
+
+/* pixel format of the pixel data written by userspace (WS281x_FMT_*) */
+extern int pixel_format;
+
+/* component order the LEDs expect (WS281x_FMT_*) */
+extern int wire_format;
+
+/* number of PWM slots per data bit (4 at 3.2MHz or 3 at 2.4MHz) */
+extern int symbol_bits;
+
+/* number of pixels from which a frame is encoded on every online CPU (0 to disable) */
+extern int encode_threshold;
+
+#endif /* __KERNEL__ */
+
 #endif /* _WS281x_H_ */
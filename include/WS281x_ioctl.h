@@ -0,0 +1,177 @@
+/*
+ * WS281x_ioctl.h
+ *
+ * ioctl interface of /dev/ws281x shared between the kernel module and userspace
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_IOCTL_H_
+#define _WS281x_IOCTL_H_
+
+#include <linux/ioctl.h> /* for _IO* macros */
+#include <linux/types.h> /* for __u32/__u64 */
+
+#define WS281x_IOC_MAGIC 'w'
+
+/* a run of changed pixel data starting at a byte offset into the frame */
+struct ws281x_run {
+  __u32 start; /* byte offset of the run into the frame */
+  __u32 len;   /* number of bytes in the run */
+  __u64 data;  /* user pointer to len bytes of pixel data (0 if already written through mmap()) */
+};
+
+/* list of runs for WS281x_IOC_UPDATE */
+struct ws281x_update {
+  __u32 num_runs; /* number of entries in runs */
+  __u32 reserved; /* must be 0 */
+  __u64 runs;     /* user pointer to an array of struct ws281x_run */
+};
+
+/* pending frame policies used when frames are paced by the refresh timer */
+#define WS281x_POLICY_QUEUE  0 /* queue every frame, writers block while the ring is full */
+#define WS281x_POLICY_LATEST 1 /* only keep the latest pending frame */
+
+/* refresh rate and pending frame policy for WS281x_IOC_SET_PACING */
+struct ws281x_pacing {
+  __u32 refresh_hz; /* frames per second (0 renders frames as soon as they are written) */
+  __u32 policy;     /* one of the WS281x_POLICY_* values */
+};
+
+/* limits of an animation played with WS281x_IOC_PLAY */
+#define WS281x_ANIM_MAX_FRAMES 256
+#define WS281x_ANIM_MAX_US     10000000 /* 10 seconds between frames */
+
+/* animation flags */
+#define WS281x_ANIM_LOOP (1 << 0) /* start over after the last frame until stopped */
+
+/* sequence of frames for WS281x_IOC_PLAY */
+struct ws281x_anim {
+  __u32 num_frames; /* number of frames in frames */
+  __u32 frame_us;   /* time from the start of one frame to the start of the next (0 for back to back) */
+  __u32 flags;      /* WS281x_ANIM_* flags */
+  __u32 reserved;   /* must be 0 */
+  __u64 frames;     /* user pointer to num_frames complete frames of pixel data back to back */
+};
+
+/* number of slots of pre-encoded frames */
+#define WS281x_MAX_SLOTS 16
+
+/* frame to store with WS281x_IOC_SLOT_STORE */
+struct ws281x_slot {
+  __u32 slot;     /* slot index (0 to WS281x_MAX_SLOTS - 1) */
+  __u32 reserved; /* must be 0 */
+  __u64 data;     /* user pointer to a complete frame of pixel data (0 to store the mmap()ed pixel buffer with the layers drawn on it) */
+};
+
+/* global brightness range for WS281x_IOC_SET_BRIGHTNESS */
+#define WS281x_BRIGHTNESS_MAX 255
+
+/* per color component lookup table for WS281x_IOC_SET_LUT */
+struct ws281x_lut {
+  __u8 lut[4][256]; /* output value for every input value of each color component in pixel format order */
+};
+
+/* pixel formats (component order and size) of the pixel data and of the LEDs */
+#define WS281x_FMT_RGB    0 /* 3 bytes per pixel */
+#define WS281x_FMT_GRB    1 /* 3 bytes per pixel (WS2812 wire order, default) */
+#define WS281x_FMT_BGR    2 /* 3 bytes per pixel */
+#define WS281x_FMT_RGBW   3 /* 4 bytes per pixel */
+#define WS281x_FMT_GRBW   4 /* 4 bytes per pixel (SK6812 RGBW wire order) */
+#define WS281x_FMT_RGB16  5 /* 3 native endian 16 bit components per pixel (pixel data only) */
+#define WS281x_FMT_RGBW16 6 /* 4 native endian 16 bit components per pixel (pixel data only) */
+
+/* pixel format of the pixel data and the LEDs for WS281x_IOC_SET_FORMAT */
+struct ws281x_format {
+  __u32 pixel_format; /* WS281x_FMT_* layout of the pixel data written by userspace */
+  __u32 wire_format;  /* WS281x_FMT_* component order the LEDs expect */
+};
+
+/* maximum number of LEDs on each strip */
+#define WS281x_MAX_LEDS 65536
+
+/* strip layout and output pins for WS281x_IOC_SET_STRIP/WS281x_IOC_GET_STRIP */
+struct ws281x_strip {
+  __u32 num_leds;  /* number of LEDs on the first strip */
+  __u32 pin_num;   /* GPIO pin of the first strip */
+  __u32 pin_fun;   /* GPIO pin alternate function of the first strip */
+  __u32 num_leds2; /* number of LEDs on the second strip (0 to disable it) */
+  __u32 pin_num2;  /* GPIO pin of the second strip */
+  __u32 pin_fun2;  /* GPIO pin alternate function of the second strip */
+};
+
+/* maximum number of layers composited over the pixel buffer */
+#define WS281x_MAX_LAYERS 16
+
+/* alpha of a layer that hides the pixels below it */
+#define WS281x_ALPHA_OPAQUE 255
+
+/* pixel range that an open file draws into with WS281x_IOC_SET_LAYER */
+struct ws281x_layer {
+  __u32 start;    /* first pixel of the layer */
+  __u32 len;      /* number of pixels in the layer (0 to draw into the shared pixel buffer again) */
+  __u32 priority; /* layers with a higher priority are drawn on top */
+  __u32 alpha;    /* opacity of the layer (0 to WS281x_ALPHA_OPAQUE) */
+};
+
+/* longest crossfade started with WS281x_IOC_FADE */
+#define WS281x_FADE_MAX_MS 3600000 /* 1 hour */
+
+/* easing curves of a crossfade (how far the fade is at each point of its duration) */
+#define WS281x_EASE_LINEAR  0 /* constant speed */
+#define WS281x_EASE_IN      1 /* starts slow and speeds up (quadratic) */
+#define WS281x_EASE_OUT     2 /* starts fast and slows down (quadratic) */
+#define WS281x_EASE_IN_OUT  3 /* starts and ends slow (smoothstep) */
+
+/* crossfade from the frame being shown to a new frame for WS281x_IOC_FADE */
+struct ws281x_fade {
+  __u32 duration_ms; /* length of the fade (0 shows the new frame at once) */
+  __u32 frame_us;    /* time from the start of one intermediate frame to the start of the next (0 for back to back) */
+  __u32 easing;      /* one of the WS281x_EASE_* curves */
+  __u32 reserved;    /* must be 0 */
+  __u64 data;        /* user pointer to the new pixel data of the file (0 if already written through mmap()) */
+};
+
+/* renders the mmap()ed pixel buffer to the LEDs */
+#define WS281x_IOC_COMMIT _IO(WS281x_IOC_MAGIC, 0)
+
+/* updates and renders only the listed runs of pixel data */
+#define WS281x_IOC_UPDATE _IOW(WS281x_IOC_MAGIC, 1, struct ws281x_update)
+
+/* changes the refresh rate and pending frame policy */
+#define WS281x_IOC_SET_PACING _IOW(WS281x_IOC_MAGIC, 2, struct ws281x_pacing)
+
+/* pre-encodes a sequence of frames and plays it back without CPU involvement (until the next frame) */
+#define WS281x_IOC_PLAY _IOW(WS281x_IOC_MAGIC, 3, struct ws281x_anim)
+
+/* stops an animation started with WS281x_IOC_PLAY (the LEDs keep the frame being shown) */
+#define WS281x_IOC_STOP _IO(WS281x_IOC_MAGIC, 4)
+
+/* encodes a complete frame into a slot once so it can be shown later */
+#define WS281x_IOC_SLOT_STORE _IOW(WS281x_IOC_MAGIC, 5, struct ws281x_slot)
+
+/* shows the frame stored in a slot (the argument is the slot index) with no encoding or copying */
+#define WS281x_IOC_SLOT_SHOW _IO(WS281x_IOC_MAGIC, 6)
+
+/* sets the gamma/color lookup table applied while encoding and renders the last frame again */
+#define WS281x_IOC_SET_LUT _IOW(WS281x_IOC_MAGIC, 7, struct ws281x_lut)
+
+/* sets the global brightness (the argument, 0 to WS281x_BRIGHTNESS_MAX) and renders the last frame again */
+#define WS281x_IOC_SET_BRIGHTNESS _IO(WS281x_IOC_MAGIC, 8)
+
+/* changes the pixel format, the last frame is rendered again if the number of bytes per pixel stays the same */
+#define WS281x_IOC_SET_FORMAT _IOW(WS281x_IOC_MAGIC, 9, struct ws281x_format)
+
+/* changes the number of LEDs and the output pins, the pixel buffer is reallocated (and has to be mapped again) */
+#define WS281x_IOC_SET_STRIP _IOW(WS281x_IOC_MAGIC, 10, struct ws281x_strip)
+
+/* reads the number of LEDs and the output pins in use */
+#define WS281x_IOC_GET_STRIP _IOR(WS281x_IOC_MAGIC, 11, struct ws281x_strip)
+
+/* makes the open file draw into its own layer over a range of pixels instead of the shared pixel buffer */
+#define WS281x_IOC_SET_LAYER _IOW(WS281x_IOC_MAGIC, 12, struct ws281x_layer)
+
+/* writes a frame and fades the LEDs to it over time, rendering the intermediate frames in the driver */
+#define WS281x_IOC_FADE _IOW(WS281x_IOC_MAGIC, 13, struct ws281x_fade)
+
+#endif /* _WS281x_IOCTL_H_ */
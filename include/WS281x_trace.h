@@ -0,0 +1,147 @@
+/*
+ * WS281x_trace.h
+ *
+ * Tracepoints along the write -> encode -> DMA path of a frame. Enable them with
+ * ftrace (/sys/kernel/debug/tracing/events/ws281x) or perf (perf record -e 'ws281x:*').
+ *
+ * Aaron Reyes
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ws281x
+
+#if !defined(_WS281x_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _WS281x_TRACE_H_
+
+#include <linux/tracepoint.h> /* for TRACE_EVENT() */
+
+/* a write() to the device file */
+TRACE_EVENT(ws281x_write,
+  TP_PROTO(loff_t off, size_t len),
+  TP_ARGS(off, len),
+  TP_STRUCT__entry(
+    __field(loff_t, off)
+    __field(size_t, len)
+  ),
+  TP_fast_assign(
+    __entry->off = off;
+    __entry->len = len;
+  ),
+  TP_printk("off=%lld len=%zu", __entry->off, __entry->len)
+);
+
+/* an ioctl() on the device file */
+TRACE_EVENT(ws281x_ioctl,
+  TP_PROTO(unsigned int cmd),
+  TP_ARGS(cmd),
+  TP_STRUCT__entry(
+    __field(unsigned int, cmd)
+  ),
+  TP_fast_assign(
+    __entry->cmd = cmd;
+  ),
+  TP_printk("cmd=0x%x", __entry->cmd)
+);
+
+/* start of encoding a frame into an encoded buffer */
+TRACE_EVENT(ws281x_encode_begin,
+  TP_PROTO(int idx, size_t len),
+  TP_ARGS(idx, len),
+  TP_STRUCT__entry(
+    __field(int, idx)
+    __field(size_t, len)
+  ),
+  TP_fast_assign(
+    __entry->idx = idx;
+    __entry->len = len;
+  ),
+  TP_printk("buf=%d frame_len=%zu", __entry->idx, __entry->len)
+);
+
+/* end of encoding a frame: pixel data bytes re-encoded and encoded bytes to send */
+TRACE_EVENT(ws281x_encode_end,
+  TP_PROTO(int idx, size_t bytes, size_t txfr_len),
+  TP_ARGS(idx, bytes, txfr_len),
+  TP_STRUCT__entry(
+    __field(int, idx)
+    __field(size_t, bytes)
+    __field(size_t, txfr_len)
+  ),
+  TP_fast_assign(
+    __entry->idx = idx;
+    __entry->bytes = bytes;
+    __entry->txfr_len = txfr_len;
+  ),
+  TP_printk("buf=%d bytes=%zu txfr_len=%zu", __entry->idx, __entry->bytes, __entry->txfr_len)
+);
+
+/* start of waiting for the previous transfer with the DMA status at that time */
+TRACE_EVENT(ws281x_dma_wait,
+  TP_PROTO(u32 cs),
+  TP_ARGS(cs),
+  TP_STRUCT__entry(
+    __field(u32, cs)
+  ),
+  TP_fast_assign(
+    __entry->cs = cs;
+  ),
+  TP_printk("cs=0x%08x", __entry->cs)
+);
+
+/* end of waiting for the previous transfer with the DMA status/debug registers and the result */
+TRACE_EVENT(ws281x_dma_done,
+  TP_PROTO(u32 cs, u32 debug, int err),
+  TP_ARGS(cs, debug, err),
+  TP_STRUCT__entry(
+    __field(u32, cs)
+    __field(u32, debug)
+    __field(int, err)
+  ),
+  TP_fast_assign(
+    __entry->cs = cs;
+    __entry->debug = debug;
+    __entry->err = err;
+  ),
+  TP_printk("cs=0x%08x debug=0x%x err=%d", __entry->cs, __entry->debug, __entry->err)
+);
+
+/* a transfer handed to the DMA module */
+TRACE_EVENT(ws281x_dma_start,
+  TP_PROTO(int idx, size_t txfr_len, u32 cs),
+  TP_ARGS(idx, txfr_len, cs),
+  TP_STRUCT__entry(
+    __field(int, idx)
+    __field(size_t, txfr_len)
+    __field(u32, cs)
+  ),
+  TP_fast_assign(
+    __entry->idx = idx;
+    __entry->txfr_len = txfr_len;
+    __entry->cs = cs;
+  ),
+  TP_printk("buf=%d txfr_len=%zu cs=0x%08x", __entry->idx, __entry->txfr_len, __entry->cs)
+);
+
+/* the DMA completion interrupt of a transfer */
+TRACE_EVENT(ws281x_dma_irq,
+  TP_PROTO(u32 cs, u32 debug),
+  TP_ARGS(cs, debug),
+  TP_STRUCT__entry(
+    __field(u32, cs)
+    __field(u32, debug)
+  ),
+  TP_fast_assign(
+    __entry->cs = cs;
+    __entry->debug = debug;
+  ),
+  TP_printk("cs=0x%08x debug=0x%x", __entry->cs, __entry->debug)
+);
+
+#endif /* _WS281x_TRACE_H_ */
+
+/* the module is built out of tree so the header is found through the include path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE WS281x_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,116 @@
+/*
+ * encoder.h
+ *
+ * Table driven encoder that converts pixel data into the serial PWM bit stream.
+ * This file has no kernel dependencies so it can also be built in userspace.
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_ENCODER_H_
+#define _WS281x_ENCODER_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h> /* for uint32_t/uint8_t/size_t */
+#else
+#include <stdint.h>      /* for uint32_t/uint8_t */
+#include <stddef.h>      /* for size_t */
+#endif
+
+/* maximum number of color components per pixel (RGBW), each one has its own lookup table */
+#define ENCODER_MAX_COMPONENTS 4
+
+/* number of words handled per iteration of the bulk encode path (a multiple of 3 and 4 components) */
+#define ENCODER_BULK_LEN 12
+
+/* number of bytes in an encoded 32 bit word (one color component with 4 bit symbols) */
+#define ENCODER_WORD_LEN sizeof(uint32_t)
+
+/*
+ * builds the 256 entry lookup tables of encoded symbols (one per color component on the wire
+ * with the current pixel format and lookup table folded in). with 4 bit symbols every color
+ * component is one 32 bit word, with 3 bit symbols the 24 bits of each color component are
+ * packed across word boundaries.
+ *
+ * one - symbol sent for a 1 bit
+ * zero - symbol sent for a 0 bit
+ * bits - number of PWM slots per symbol (3 or 4)
+ */
+void encoder_init(uint32_t one, uint32_t zero, unsigned int bits);
+
+/*
+ * returns the number of bytes per pixel of one of the WS281x_FMT_* pixel formats or 0 if the
+ * format is unknown
+ */
+unsigned int encoder_format_len(unsigned int fmt);
+
+/*
+ * sets the layout of the input pixels and the order of the components on the wire. the
+ * conversion is folded into the encode loop. a white component the pixel data does not have
+ * (RGB data on RGBW LEDs) is always sent as 0, so the white LED stays off. returns 0 on
+ * success or -1 for an invalid pair.
+ *
+ * pixel_fmt - WS281x_FMT_* layout of the pixel data handed to the encoder
+ * wire_fmt - WS281x_FMT_* order the LEDs expect (8 bits per component only)
+ */
+int encoder_set_format(unsigned int pixel_fmt, unsigned int wire_fmt);
+
+/*
+ * returns the number of bytes of pixel data per pixel in the current format
+ */
+unsigned int encoder_pixel_len(void);
+
+/*
+ * returns the number of encoded words per pixel on the wire in the current format
+ */
+unsigned int encoder_wire_len(void);
+
+/*
+ * returns the number of 32 bit words that a number of pixels is encoded into on one channel
+ * (the last word is padded with low slots)
+ */
+size_t encoder_words(size_t pixels);
+
+/*
+ * returns the number of whole pixels encoded in a number of 32 bit words on one channel
+ */
+size_t encoder_pixels(size_t words);
+
+/*
+ * returns the number of pixels whose encoded symbols end on a word boundary. runs of pixels
+ * can only be encoded starting at a multiple of it (1 unless symbols are packed).
+ */
+unsigned int encoder_group_len(void);
+
+/*
+ * sets the lookup table (gamma/brightness) applied to each color component while encoding.
+ * the table is folded into the encode tables so it costs nothing per pixel.
+ *
+ * lut - output value for every input value of each component in input pixel order (NULL for identity)
+ */
+void encoder_set_lut(const uint8_t lut[ENCODER_MAX_COMPONENTS][256]);
+
+/*
+ * encodes pixels into every stride'th word of dst. a stride greater than 1 interleaves the
+ * words of several PWM channels that share one FIFO.
+ *
+ * dst - 32 bit aligned output buffer with room for encoder_words(pixels) * stride words (the
+ *       first pixel must start a group of encoder_group_len() pixels)
+ * src - pixel data in the current pixel format
+ * pixels - number of pixels in src
+ * stride - distance in words between consecutive output words
+ */
+void encoder_run(uint32_t *dst, const uint8_t *src, size_t pixels, size_t stride);
+
+/*
+ * decodes every stride'th word of an encoded buffer back into bytes in wire order. any symbol
+ * other than the one used for a 1 bit decodes as a 0 bit.
+ *
+ * dst - output buffer with room for len bytes
+ * src - 32 bit aligned encoded words starting at a group of encoder_group_len() pixels
+ * len - number of bytes to decode
+ * stride - distance in words between consecutive encoded words
+ */
+void encoder_decode(uint8_t *dst, const uint32_t *src, size_t len, size_t stride);
+
+#endif /* _WS281x_ENCODER_H_ */
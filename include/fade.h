@@ -0,0 +1,43 @@
+/*
+ * fade.h
+ *
+ * Timer that steps crossfades between frames and the easing curves applied to them
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_FADE_H_
+#define _WS281x_FADE_H_
+
+/* progress of a fade in fixed point, FADE_ONE is the end of the fade */
+#define FADE_SHIFT 16
+#define FADE_ONE   (1U << FADE_SHIFT)
+
+/*
+ * sets up the fade timer. returns 0 on success or a negative error code.
+ */
+int fade_init(void);
+
+/*
+ * starts timing a fade from now, replacing any fade being timed. the first intermediate frame
+ * is rendered right away by calling frame_fade_tick() and the next ones are rendered as long as
+ * it returns non-zero.
+ *
+ * duration_ms - length of the fade
+ * frame_us - time from the start of one intermediate frame to the start of the next (0 for back to back)
+ * easing - one of the WS281x_EASE_* curves
+ */
+void fade_start(unsigned int duration_ms, unsigned int frame_us, unsigned int easing);
+
+/*
+ * returns how far the fade is at the current time with the easing curve applied (0 to
+ * FADE_ONE, which is only returned once the duration is over)
+ */
+unsigned int fade_progress(void);
+
+/*
+ * stops the fade timer, the fade must already be over (frame_fade_tick() returns 0)
+ */
+void fade_cleanup(void);
+
+#endif /* _WS281x_FADE_H_ */
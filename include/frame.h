@@ -0,0 +1,233 @@
+/*
+ * frame.h
+ *
+ * Kernel side pixel buffer that can be written to or mmap()ed by userspace
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_FRAME_H_
+#define _WS281x_FRAME_H_
+
+#include <linux/mm.h>   /* for struct vm_area_struct */
+#include <linux/uio.h>  /* for struct iov_iter */
+#include <linux/poll.h> /* for poll_table */
+
+#include <WS281x_ioctl.h> /* for struct ws281x_update */
+
+/* what an open file draws into (the shared pixel buffer or its own layer) */
+struct frame_layer;
+
+/*
+ * allocates the pixel buffer and brings up the hardware. returns 0 on success or a negative
+ * error code.
+ */
+int frame_init(void);
+
+/*
+ * sets up what a newly opened file draws into, the shared pixel buffer until
+ * frame_set_layer() is called. returns NULL if out of memory.
+ */
+struct frame_layer *frame_open(void);
+
+/*
+ * copies pixel data into the pixel buffer (or the file's layer) at an offset and renders it.
+ * only the written range is re-encoded and the rest of the frame keeps its previous contents.
+ * data past the end of the strip (or layer) is ignored.
+ *
+ * layer - what the file draws into
+ * from - pixel data from userspace
+ * off - byte offset into the frame
+ * nonblock - non-zero to fail with -EAGAIN instead of waiting for the previous frame
+ *
+ * returns the number of bytes written or a negative error code
+ */
+ssize_t frame_write(struct frame_layer *layer, struct iov_iter *from, loff_t off, int nonblock);
+
+/*
+ * applies a list of runs of pixel data and renders the frame, only re-encoding those runs.
+ * the runs are relative to the file's layer if it has one.
+ *
+ * layer - what the file draws into
+ * arg - user space struct ws281x_update
+ * nonblock - non-zero to fail with -EAGAIN instead of waiting for the previous frame
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_update(struct frame_layer *layer, const struct ws281x_update __user *arg, int nonblock);
+
+/*
+ * renders the current contents of the pixel buffer (or the file's layer). returns 0 on
+ * success or a negative error code.
+ *
+ * layer - what the file draws into
+ * nonblock - non-zero to fail with -EAGAIN instead of waiting for the previous frame
+ */
+int frame_commit(struct frame_layer *layer, int nonblock);
+
+/*
+ * pre-encodes a sequence of frames and plays it back without CPU involvement until
+ * frame_stop() or the next frame is rendered
+ *
+ * arg - user space struct ws281x_anim
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_play(const struct ws281x_anim __user *arg);
+
+/*
+ * stops the animation started by frame_play(). returns 0 on success or a negative error code.
+ */
+int frame_stop(void);
+
+/*
+ * encodes a complete frame (from userspace or the pixel buffer) into a slot
+ *
+ * arg - user space struct ws281x_slot
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_slot_store(const struct ws281x_slot __user *arg);
+
+/*
+ * shows the frame stored in a slot. the pixel buffer is left alone and the next frame that is
+ * rendered is sent whole. returns 0 on success or a negative error code.
+ *
+ * slot - slot index
+ */
+int frame_slot_show(unsigned long slot);
+
+/*
+ * sets the per color component lookup table (gamma/color correction) applied while encoding
+ * and renders the last frame again with it
+ *
+ * arg - user space struct ws281x_lut
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_set_lut(const struct ws281x_lut __user *arg);
+
+/*
+ * sets the global brightness applied on top of the lookup table and renders the last frame
+ * again with it, without any pixel data from userspace
+ *
+ * brightness - 0 to WS281x_BRIGHTNESS_MAX
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_set_brightness(unsigned long brightness);
+
+/*
+ * changes the pixel format of the pixel data and the LEDs. a format with the same number of
+ * bytes per pixel renders the last frame again in it, any other format reallocates the pixel
+ * buffer like frame_set_strip()
+ *
+ * arg - user space struct ws281x_format
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_set_format(const struct ws281x_format __user *arg);
+
+/*
+ * changes the number of LEDs and the output pins without reloading the module. the pixel
+ * buffer is reallocated (existing mappings keep the old one and have to be mapped again),
+ * stored slots are freed and the next frame is sent whole. on failure the previous strip
+ * layout is laid out again, if that fails too frames fail with -ENODEV until a later layout
+ * succeeds. fails with -EBUSY while any file has a layer.
+ *
+ * arg - user space struct ws281x_strip
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_set_strip(const struct ws281x_strip __user *arg);
+
+/*
+ * copies the number of LEDs and the output pins in use to userspace
+ *
+ * arg - user space struct ws281x_strip
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_get_strip(struct ws281x_strip __user *arg);
+
+/*
+ * changes the refresh rate and pending frame policy used when pacing frames. frames still
+ * pending are dropped and the latest pixel buffer is rendered directly. returns 0 on success
+ * or a negative error code.
+ *
+ * hz - refresh rate in frames per second (0 renders frames as soon as they are written)
+ * policy - one of the WS281x_POLICY_* values
+ */
+int frame_set_pacing(unsigned int hz, unsigned int policy);
+
+/*
+ * renders the oldest frame pending in the pacer ring (called by the refresh timer work)
+ */
+void frame_tick(void);
+
+/*
+ * copies new pixel data into the pixel buffer (or the file's layer) and fades the LEDs from
+ * the frame being shown to it over time: the last frame rendered, a slot that is shown or the
+ * frame an animation is on (the animation is stopped). the intermediate frames are
+ * interpolated and rendered by the driver on a timer. frames still pending in the pacer ring
+ * are dropped and a fade that is running starts over from the frame being shown. the next frame that is rendered ends the
+ * fade at once.
+ *
+ * layer - what the file draws into
+ * arg - user space struct ws281x_fade
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_fade(struct frame_layer *layer, const struct ws281x_fade __user *arg);
+
+/*
+ * renders the next intermediate frame of the fade that is running (called by the fade timer
+ * work). returns non-zero if there are more frames to render.
+ */
+int frame_fade_tick(void);
+
+/*
+ * gives a file its own layer over a range of pixels, which is blended over the pixel buffer by
+ * priority and alpha every time a frame is rendered. a new layer starts out with the pixels
+ * below it, changing only the position, priority or alpha keeps its pixel data. a length of 0
+ * removes the layer and the file draws into the pixel buffer again.
+ *
+ * layer - what the file draws into
+ * arg - user space struct ws281x_layer
+ *
+ * returns 0 on success or a negative error code
+ */
+int frame_set_layer(struct frame_layer *layer, const struct ws281x_layer __user *arg);
+
+/*
+ * maps the pixel buffer (or the file's layer) into a user process. returns 0 on success or a
+ * negative error code.
+ *
+ * layer - what the file draws into
+ */
+int frame_mmap(struct frame_layer *layer, struct vm_area_struct *vma);
+
+/*
+ * reports whether another frame can be written without blocking: the pacer ring has room or,
+ * without pacing, the previous transfer is done
+ *
+ * filep - file being polled
+ * wait - poll table of the caller
+ *
+ * returns EPOLLOUT | EPOLLWRNORM when ready, 0 otherwise
+ */
+__poll_t frame_poll(struct file *filep, poll_table *wait);
+
+/*
+ * removes the layer of a file that is closed (the pixels below it show again) and frees it
+ *
+ * layer - what the file draws into
+ */
+void frame_close(struct frame_layer *layer);
+
+/*
+ * shuts down the hardware and frees the pixel buffer
+ */
+void frame_cleanup(void);
+
+#endif /* _WS281x_FRAME_H_ */
@@ -9,21 +9,110 @@
 #ifndef _WS281x_HAL_H_
 #define _WS281x_HAL_H_
 
+#include <linux/poll.h> /* for poll_table */
+
 /* rounds num up to the nearest multiple of div */
 #define ROUND_UP(num, div) (num + ((div - (num % div)) % div))
 
 /*
- * initializes the hardware interface. returns -1 on failure or 0 on success.
+ * initializes the hardware interface for the current strip layout (done once at module load).
+ * returns 0 on success or a negative error code.
  */
 int hal_init(void);
 
 /*
- * renders the user buffer to the WS281x LEDs using the hardware interface
+ * lays out the strips again from the current num_leds/pin/format parameters without taking
+ * the rest of the hardware down: any animation is stopped, the encoded buffers are reallocated,
+ * stored slots are freed and the output pins are switched over. the LEDs keep their colors and
+ * the next hal_render() sends the whole frame. returns 0 on success or a negative error code
+ * (-EINVAL for pins the platform can not use). on failure there is no strip: hal_render(),
+ * hal_play() and hal_slot_*() return -ENODEV until a later hal_configure() succeeds.
+ */
+int hal_configure(void);
+
+/*
+ * marks a range of pixel data as changed so the next hal_render() re-encodes it
+ *
+ * start - byte offset of the first changed byte of pixel data
+ * len - number of changed bytes
+ */
+void hal_invalidate(size_t start, size_t len);
+
+/*
+ * renders the user buffer to the WS281x LEDs using the hardware interface. only the ranges
+ * marked with hal_invalidate() since the last render are re-encoded and the frame is only sent
+ * up to the last changed pixel (nothing is sent if no pixel changed). sleeps until the previous
+ * frame is done transmitting. returns 0 on success or a negative error code.
  *
- * buf - the user supplied buffer copied into kernel memory
+ * buf - the complete frame of pixel data in kernel memory
  * len - length of buf
  */
-void hal_render(const char *buf, size_t len);
+int hal_render(const char *buf, size_t len);
+
+/*
+ * returns non-zero if hal_render() can send a frame right away without sleeping for the
+ * previous one (nothing is being sent or an animation is playing, which a new frame replaces)
+ */
+int hal_ready(void);
+
+/*
+ * adds the wait queue that is woken whenever a transfer completes to a poll table
+ *
+ * filep - file being polled
+ * wait - poll table of the caller
+ */
+void hal_poll_wait(struct file *filep, poll_table *wait);
+
+/*
+ * sets the lookup table applied to each color component of the pixel data while encoding and
+ * marks every pixel as changed so the next hal_render() sends the whole frame with it
+ *
+ * lut - output value for every input value of each color component in frame order
+ */
+void hal_set_lut(const uint8_t lut[][256]);
+
+/*
+ * pre-encodes a sequence of frames and plays it back without CPU involvement. the animation
+ * runs until hal_stop() or the next hal_render() (the LEDs then get the complete frame).
+ * returns 0 on success, -EINVAL if frame_us is longer than the platform can wait between
+ * frames or another negative error code.
+ *
+ * frames - num_frames complete frames of pixel data back to back in kernel memory
+ * num_frames - number of frames
+ * frame_us - time from the start of one frame to the start of the next (at least the wire time)
+ * loop - non-zero to start over after the last frame
+ */
+int hal_play(const char *frames, unsigned int num_frames, unsigned int frame_us, int loop);
+
+/*
+ * stops an animation started with hal_play(), the LEDs keep the frame being shown
+ */
+void hal_stop(void);
+
+/*
+ * returns the index of the animation frame the LEDs are showing (the one being sent or the
+ * last one that was sent) or -1 if no animation is playing
+ */
+int hal_anim_frame(void);
+
+/*
+ * encodes a complete frame into a slot so it can be shown later without any encoding or
+ * copying. the slot buffer is allocated on first use. returns 0 on success or a negative
+ * error code.
+ *
+ * slot - slot index (0 to WS281x_MAX_SLOTS - 1)
+ * buf - complete frame of pixel data in kernel memory
+ */
+int hal_slot_store(unsigned int slot, const char *buf);
+
+/*
+ * sends the frame stored in a slot to the LEDs by pointing a control block at it. the next
+ * hal_render() sends its frame whole. returns 0 on success, -ENOENT if nothing is stored in the
+ * slot or another negative error code.
+ *
+ * slot - slot index (0 to WS281x_MAX_SLOTS - 1)
+ */
+int hal_slot_show(unsigned int slot);
 
 /*
  * un-initializes the hardware interface
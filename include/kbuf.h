@@ -0,0 +1,85 @@
+/*
+ * kbuf.h
+ *
+ * Bookkeeping shared by the platforms for the encoded (PWM) buffers: layout of the strips,
+ * pixels that changed since each buffer was last encoded and how much of a frame to send
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_KBUF_H_
+#define _WS281x_KBUF_H_
+
+#include <linux/types.h> /* for size_t */
+
+/* number of encoded buffers used to encode one frame while the other is transmitted */
+#define NUM_KBUFS 2
+
+/* maximum number of output channels (and LED strips) sharing one encoded buffer */
+#define NUM_CHANS 2
+
+/* number of pixels each CPU encodes at a time when a frame is encoded in parallel. a multiple
+ * of every group length so chunks never share an encoded word, and small enough that the
+ * encoded chunk (12KB in GRB with 4 bit symbols) stays in the cache of the CPU encoding it. */
+#define KBUF_CHUNK_LEN 1024
+
+/* number of channels in use (2 when a second strip is configured) */
+extern int kbuf_chans;
+
+/* byte offset and length of each channel's pixel data in the frame and the total frame length */
+extern size_t kbuf_chan_off[NUM_CHANS];
+extern size_t kbuf_chan_len[NUM_CHANS];
+extern size_t kbuf_frame_len;
+
+/* number of LEDs on each channel */
+extern size_t kbuf_chan_leds[NUM_CHANS];
+
+/* length in bytes of each encoded buffer (the longer strip sets the length of all channels) */
+extern size_t kbuf_len;
+
+/*
+ * lays out the strips in the current pixel format and marks every pixel as changed. returns 0
+ * on success or a negative error code.
+ */
+int kbuf_init(void);
+
+/*
+ * marks a range of pixel data as changed in every encoded buffer
+ *
+ * start - byte offset of the first changed byte of pixel data
+ * len - number of changed bytes
+ */
+void kbuf_invalidate(size_t start, size_t len);
+
+/*
+ * re-encodes the changed pixel data into an encoded buffer, only up to the last pixel that
+ * changed since the previous frame was sent. returns the number of encoded bytes to send
+ * (0 if nothing changed).
+ *
+ * dst - encoded buffer
+ * idx - index of dst (0 to NUM_KBUFS - 1)
+ * buf - complete frame of pixel data
+ * len - length of buf
+ */
+size_t kbuf_encode(char *dst, int idx, const char *buf, size_t len);
+
+/*
+ * encodes a complete frame into a zeroed buffer of kbuf_len bytes that is not one of the
+ * ping-pong buffers (no changed pixel tracking)
+ *
+ * dst - encoded buffer
+ * buf - complete frame of pixel data (kbuf_frame_len bytes)
+ */
+void kbuf_encode_frame(char *dst, const char *buf);
+
+/*
+ * records that the frame returned by the last kbuf_encode() was sent
+ */
+void kbuf_sent(void);
+
+/*
+ * frees the bookkeeping, kbuf_invalidate() does nothing until the next kbuf_init()
+ */
+void kbuf_cleanup(void);
+
+#endif /* _WS281x_KBUF_H_ */
@@ -0,0 +1,112 @@
+/*
+ * pacer.h
+ *
+ * Ring of pending frames that are rendered at a fixed refresh rate by an hrtimer
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_PACER_H_
+#define _WS281x_PACER_H_
+
+#include <linux/types.h> /* for size_t */
+#include <linux/poll.h>  /* for poll_table */
+
+/* maximum number of pending frames in the ring */
+#define PACER_MAX_DEPTH 16
+
+/* maximum refresh rate of the timer */
+#define PACER_MAX_HZ 1000 // Hz
+
+/*
+ * initializes the pacer from the module parameters. returns 0 on success or a negative error code.
+ *
+ * frame_len - length in bytes of one frame of pixel data
+ */
+int pacer_init(size_t frame_len);
+
+/*
+ * starts the refresh timer (if pacing is enabled) once the hardware is ready. must be called
+ * with ws281x_mutex held.
+ */
+void pacer_start(void);
+
+/*
+ * stops the refresh timer, waits for any frame being rendered by it and drops pending frames,
+ * waking writers that wait for room. must be called with ws281x_mutex held.
+ */
+void pacer_stop(void);
+
+/*
+ * changes the refresh rate and pending frame policy. the pacer must be stopped and any
+ * pending frames are dropped. returns 0 on success or a negative error code.
+ *
+ * hz - refresh rate in frames per second (0 renders frames as soon as they are written)
+ * policy - one of the WS281x_POLICY_* values
+ */
+int pacer_configure(unsigned int hz, unsigned int policy);
+
+/*
+ * changes the length of the frames kept in the ring. the pacer must be stopped and any pending
+ * frames are dropped. returns 0 on success or -ENOMEM (the ring is left as it was).
+ *
+ * frame_len - length in bytes of one frame of pixel data
+ */
+int pacer_resize(size_t frame_len);
+
+/*
+ * returns non-zero if frames are queued for the refresh timer instead of rendered directly
+ */
+int pacer_enabled(void);
+
+/*
+ * returns non-zero if another frame can be pushed without blocking
+ */
+int pacer_room(void);
+
+/*
+ * sleeps until another frame can be pushed. returns 0 or -ERESTARTSYS if interrupted.
+ */
+int pacer_wait_room(void);
+
+/*
+ * adds the wait queue that is woken whenever a frame leaves the ring to a poll table
+ *
+ * filep - file being polled
+ * wait - poll table of the caller
+ */
+void pacer_poll_wait(struct file *filep, poll_table *wait);
+
+/*
+ * copies a frame into the ring. with WS281x_POLICY_LATEST the frame replaces any frame
+ * still pending. returns 0 on success or -EAGAIN if the ring is full.
+ *
+ * frame - complete frame of pixel data
+ */
+int pacer_push(const char *frame);
+
+/*
+ * copies a frame into the ring like pacer_push() but never fails: while the ring is full the
+ * newest pending frame is replaced instead
+ *
+ * frame - complete frame of pixel data
+ */
+void pacer_push_over(const char *frame);
+
+/*
+ * removes the oldest pending frame from the ring. returns NULL if no frame is pending. the
+ * returned frame stays valid until the next call to pacer_push().
+ */
+const char *pacer_pop(void);
+
+/*
+ * drops every pending frame and releases blocked writers. must be called with frame_lock held.
+ */
+void pacer_drop(void);
+
+/*
+ * stops the pacer and frees the ring
+ */
+void pacer_cleanup(void);
+
+#endif /* _WS281x_PACER_H_ */
@@ -0,0 +1,81 @@
+/*
+ * stats.h
+ *
+ * Runtime performance counters of the driver, readable from debugfs while the module is loaded
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_STATS_H_
+#define _WS281x_STATS_H_
+
+#include <linux/types.h>   /* for u64/size_t */
+#include <linux/debugfs.h> /* for struct dentry */
+
+/* number of log2 buckets (in microseconds) of the inter-frame interval histogram */
+#define STATS_HIST_BUCKETS 20
+
+/* causes of a failed transfer (the first three match the BCM2835 DMA DEBUG register bits) */
+enum stats_dma_error {
+  STATS_DMA_READ_LAST_NOT_SET,
+  STATS_DMA_FIFO,
+  STATS_DMA_READ,
+  STATS_DMA_TIMEOUT,
+  STATS_DMA_ERRORS
+};
+
+/*
+ * creates the debugfs directory and the stats file. the counters are kept until the
+ * module is unloaded. returns 0 on success or a negative error code.
+ */
+int stats_init(void);
+
+/*
+ * returns the debugfs directory of the driver so other parts can add their own files
+ */
+struct dentry *stats_debugfs_dir(void);
+
+/*
+ * records one encode pass of a frame
+ *
+ * bytes - number of pixel data bytes re-encoded
+ * ns - time spent encoding
+ */
+void stats_encode(size_t bytes, u64 ns);
+
+/*
+ * records the time spent waiting for the previous transfer to finish
+ */
+void stats_wait(u64 ns);
+
+/*
+ * records a frame handed to the hardware and the interval since the previous one
+ */
+void stats_frame(void);
+
+/*
+ * records a failed transfer
+ */
+void stats_dma_error(enum stats_dma_error cause);
+
+/*
+ * records pending frames that were dropped without being rendered
+ */
+void stats_dropped(unsigned int frames);
+
+/*
+ * records a pending frame that was replaced by a newer one
+ */
+void stats_coalesced(void);
+
+/*
+ * records a refresh timer tick that found the previous frame still rendering
+ */
+void stats_late_tick(void);
+
+/*
+ * removes the debugfs files
+ */
+void stats_cleanup(void);
+
+#endif /* _WS281x_STATS_H_ */
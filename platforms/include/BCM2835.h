@@ -20,20 +20,31 @@
 /* rate of the oscillator crystal is 19.2MHz */
 #define OSC_FREQ 19200000 // hz
 
-/* number of bytes that is used to represent a WS281x LED internally */
+/* number of bytes that is used to represent a WS281x LED internally (PWM slots per bit with 4 bit symbols) */
 #define BYTES_PER_WS281x 4
 
 /* constants used to define a 1/0 as seen by the WS281x LED in the PWM buffer */
 #define WS281x_1 ((char)0xC) // 1100
 #define WS281x_0 ((char)0x8) // 1000
 
+/* 3 bit symbols for a 1/0 used with symbol_bits=3 (2.4MHz PWM clock) */
+#define WS281x_1_3BIT ((char)0x6) // 110
+#define WS281x_0_3BIT ((char)0x4) // 100
+
 /* hardware timing delay */
 #define HW_DELAY_US 10 // microseconds
 
+/* slack added to the expected wire time of a frame before a DMA transfer is considered stuck */
+#define DMA_TIMEOUT_MS 100 // milliseconds
+
 /* memory mapping specification for GPIO registers */
 #define GPIO_BASE 0x20200000 // physical address
 #define GPIO_SIZE (40 * sizeof(uint32_t))
 
+/* number of GPIO pins and of alternate functions per pin */
+#define GPIO_NUM_PINS 54
+#define GPIO_NUM_FUNS 6
+
 /* MMIO offsets for GPIO registers */
 #define GPIO_GPFSEL0   0
 #define GPIO_GPFSEL1   1
@@ -146,6 +157,10 @@
 #define DMA5_BASE 0x20007500 // physical address
 #define DMA5_SIZE (9 * sizeof(uint32_t))
 
+/* device tree node of the DMA controller and the index of channel 5 in its interrupts */
+#define DMA_COMPATIBLE "brcm,bcm2835-dma"
+#define DMA5_IRQ_INDEX 5
+
 /* MMIO offsets for DMA registers */
 #define DMA5_CS        0
 #define DMA5_CONBLK_AD 1
@@ -189,6 +204,9 @@
 #define DMA5_TI_INTEN                      (1 << 0)
 #define DMA5_TXFR_LEN_YLENGTH(x)           ((x & 0xFFFF) << 16)
 #define DMA5_TXFR_LEN_XLENGTH(x)           ((x & 0xFFFF) << 0)
+
+/* largest word aligned length one control block can transfer (TXFR_LEN is 30 bits) */
+#define DMA5_TXFR_LEN_MAX 0x3FFFFFFCULL
 #define DMA5_STRIDE_D_STRIDE(x)            ((x & 0xFFFF) << 16)
 #define DMA5_STRIDE_S_STRIDE(x)            ((x & 0xFFFF) << 0)
 #define DMA5_DEBUG_READ_ERROR              (1 << 2)
@@ -0,0 +1,30 @@
+/*
+ * loopback.h
+ *
+ * Constants specific to the simulated loopback platform. Nothing is sent to any hardware,
+ * the encoded frames are captured and DMA completion is simulated at the real wire rate.
+ *
+ * Aaron Reyes
+ */
+
+#ifndef _WS281x_LOOPBACK_H_
+#define _WS281x_LOOPBACK_H_
+
+/* number of bytes that is used to represent a WS281x LED internally (same as the BCM2835 PWM) */
+#define BYTES_PER_WS281x 4
+
+/* constants used to define a 1/0 as seen by the WS281x LED in the encoded buffer */
+#define WS281x_1 ((char)0xC) // 1100
+#define WS281x_0 ((char)0x8) // 1000
+
+/* 3 bit symbols for a 1/0 used with symbol_bits=3 */
+#define WS281x_1_3BIT ((char)0x6) // 110
+#define WS281x_0_3BIT ((char)0x4) // 100
+
+/* simulated wire time of one encoded byte (8 slots at x slots per bit * WS281x_RATE) */
+#define WIRE_NS_PER_BYTE(x) ((8ULL * 1000000000ULL) / ((x) * WS281x_RATE)) // nanoseconds
+
+/* name of the debugfs directory (inside the driver's one) holding the captured output */
+#define LOOPBACK_DEBUGFS_DIR "loopback"
+
+#endif /* _WS281x_LOOPBACK_H_ */
@@ -14,13 +14,29 @@
 #include <linux/kernel.h> /* for printk KERN_INFO */
 #include <linux/delay.h>  /* for udelay() */
 #include <linux/string.h> /* for memset() */
-#include <linux/err.h>    /* for error checking functions like IS_ERR() */
-#include <linux/gfp.h>    /* for __get_free_pages() */
-#include <asm/io.h>       /* for read/write IO operations and virtual/physical translation */
+#include <linux/gfp.h>    /* for alloc_page() */
+#include <linux/dma-mapping.h> /* for dma_map_page()/dma_alloc_coherent() */
+#include <linux/vmalloc.h> /* for vmap() */
+#include <linux/highmem.h> /* for flush_kernel_vmap_range() */
+#include <linux/slab.h>   /* for kcalloc() */
+#include <linux/math64.h> /* for div_u64() */
+#include <linux/interrupt.h> /* for request_irq() */
+#include <linux/ktime.h>  /* for ktime_get_ns() */
+#include <linux/wait.h>   /* for wait queues */
+#include <linux/jiffies.h> /* for msecs_to_jiffies() */
+#include <linux/of.h>     /* for of_find_compatible_node() */
+#include <linux/of_platform.h> /* for of_find_device_by_node() */
+#include <linux/platform_device.h> /* for platform_get_irq() */
+#include <asm/io.h>       /* for read/write IO operations */
 #include <asm/page.h>     /* for PAGE_SIZE */
 
 #include <hal.h>          /* for interface definition and ROUND_UP */
+#include <encoder.h>      /* for the table driven pixel encoder */
+#include <stats.h>        /* for performance counters */
+#include <kbuf.h>         /* for the encoded buffer bookkeeping */
+#include <WS281x_trace.h> /* for tracepoints */
 #include <WS281x.h>       /* for WS281x macros and user parameters */
+#include <WS281x_ioctl.h> /* for WS281x_MAX_SLOTS */
 #include <BCM2835.h>      /* for platform specific addresses */
 
 /* DMA control block definition */
@@ -34,12 +50,63 @@ struct dma_cb_t {
   uint32_t reserved[2];
 } __attribute__((packed)); // no padding allowed
 
-/* the DMA control block must be 256 bit (or 32 byte) aligned */
-static struct dma_cb_t *dma_cb;
+/* number of control blocks that fit in a page (control blocks must be 256 bit or 32 byte aligned) */
+#define CBS_PER_PAGE (PAGE_SIZE / sizeof(struct dma_cb_t))
 
-/* internal buffer and its length */
-static char *kbuf;
-static uint32_t kbuf_len;
+/* encoded buffer built from single pages so no physically contiguous allocation is needed. the
+ * pages are mapped back to back for the encoder and streamed by one control block per page,
+ * chained to a tail control block (RESET signal or animation spacer). the pages are streaming
+ * DMA mappings that are synced for every frame, the control blocks are rewritten for every
+ * frame too so they live in coherent memory. */
+struct dma_buf_t {
+  char *virt;               /* contiguous mapping of the pages (NULL if not allocated) */
+  struct page **pages;      /* pages of encoded data */
+  dma_addr_t *page_dma;     /* bus address of each page */
+  unsigned int num_pages;
+  unsigned int num_mapped;  /* number of pages mapped for DMA */
+  struct dma_cb_t **cb;     /* pages of control blocks, num_pages + 1 control blocks in total */
+  dma_addr_t *cb_dma;       /* bus address of each page of control blocks */
+  unsigned int num_cb_pages;
+};
+
+/* pre-encoded frames stored with hal_slot_store() (kbuf_len bytes each) */
+static struct dma_buf_t slot_buf[WS281x_MAX_SLOTS];
+
+/* internal ping-pong buffers (kbuf_len bytes each) */
+static struct dma_buf_t kbuf[NUM_KBUFS];
+
+/* all zero page streamed after the pixel data for the WS281x RESET signal and the length sent
+ * for the channels in use */
+static char *reset_buf;
+static dma_addr_t reset_dma;
+static uint32_t reset_len;
+
+/* index of the idle buffer that the next frame is encoded into */
+static int kbuf_idx;
+
+/* wait queue woken by the DMA completion interrupt */
+static DECLARE_WAIT_QUEUE_HEAD(dma_waitq);
+
+/* DMA5_DEBUG error bits latched by the interrupt handler */
+static uint32_t dma_err;
+
+/* interrupt line in use for DMA completion */
+static int dma_irq_num;
+
+/* DMA controller from the device tree, the buffers are mapped for it */
+static struct platform_device *dma_pdev;
+static struct device *dma_dev;
+
+/* GPIO pins currently set up for PWM output (-1 if none) */
+static int strip_pin[NUM_CHANS] = { -1, -1 };
+
+/* non-zero while the strips are laid out (a failed hal_configure() leaves none) */
+static int strip_ready;
+
+/* animation played by hal_play(): one encoded buffer per frame, its tail control block is the RESET/spacer */
+static struct dma_buf_t *anim_buf;
+static unsigned int anim_frames;
+static int anim_active;
 
 /* structure pointers for MMIO operations */
 static volatile uint32_t *CM;
@@ -68,6 +135,17 @@ static void gpio_config(uint32_t pin, uint32_t fun) {
 }
 
 
+/*
+ * Returns a GPIO pin to its reset state (input) so it no longer drives the LEDs
+ */
+static void gpio_release(uint32_t pin) {
+  uint32_t reg = pin / 10;
+  uint32_t offset = (pin % 10) * 3;
+  iowrite32(ioread32(GPIO + reg) & ~(0x7 << offset), GPIO + reg);
+  udelay(HW_DELAY_US);
+}
+
+
 /*
  * stops the PWM clock generator and turns off the PWM module
  */
@@ -90,8 +168,8 @@ static void pwm_stop(void) {
  * initializes the PWM module/clock manager and configures GPIO for PWM output
  */
 static void pwm_start(void) {
-  // setup the PWM clock manager to 3 x PIXEL_RATE
-  iowrite32(CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(OSC_FREQ / (BYTES_PER_WS281x * WS281x_RATE)), CM + CM_PWM_DIV);
+  // setup the PWM clock manager to one slot per symbol_bits of the pixel rate (3.2MHz or 2.4MHz)
+  iowrite32(CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(OSC_FREQ / (symbol_bits * WS281x_RATE)), CM + CM_PWM_DIV);
   udelay(HW_DELAY_US);
   // source the PWM clock from the oscillator with no MASH filtering
   iowrite32(CM_PWM_CTL_PASSWD | CM_PWM_CTL_MASH(0) | CM_PWM_CTL_SRC_OSC, CM + CM_PWM_CTL);
@@ -104,33 +182,147 @@ static void pwm_start(void) {
   // configure 32 bit period transfers
   iowrite32(32, PWM + PWM_RNG1);
   udelay(HW_DELAY_US);
+  if (kbuf_chans > 1) {
+    iowrite32(32, PWM + PWM_RNG2);
+    udelay(HW_DELAY_US);
+  }
   // clear the FIFO
   iowrite32(PWM_CTL_CLRF1, PWM + PWM_CTL);
   udelay(HW_DELAY_US);
   // enable DMA for PWM with alerts at (PWM_FIFO_SIZE / 2)
   iowrite32(PWM_DMAC_ENAB | PWM_DMAC_PANIC(PWM_FIFO_SIZE / 2) | PWM_DMAC_DREQ(PWM_FIFO_SIZE / 2), PWM + PWM_DMAC);
   udelay(HW_DELAY_US);
-  // configure PWM channel to send data serially out of the FIFO
-  iowrite32(PWM_CTL_MODE1 | PWM_CTL_USEF1, PWM + PWM_CTL);
-  udelay(HW_DELAY_US);
-  // enable the PWM module
-  iowrite32(ioread32(PWM + PWM_CTL) | PWM_CTL_PWEN1, PWM + PWM_CTL);
-  udelay(HW_DELAY_US);
+  // configure PWM channel(s) to send data serially out of the FIFO. with both channels
+  // using the FIFO the words are consumed alternately by channel 1 and channel 2.
+  if (kbuf_chans > 1) {
+    iowrite32(PWM_CTL_MODE1 | PWM_CTL_USEF1 | PWM_CTL_MODE2 | PWM_CTL_USEF2, PWM + PWM_CTL);
+    udelay(HW_DELAY_US);
+    // enable the PWM module
+    iowrite32(ioread32(PWM + PWM_CTL) | PWM_CTL_PWEN1 | PWM_CTL_PWEN2, PWM + PWM_CTL);
+    udelay(HW_DELAY_US);
+  } else {
+    iowrite32(PWM_CTL_MODE1 | PWM_CTL_USEF1, PWM + PWM_CTL);
+    udelay(HW_DELAY_US);
+    // enable the PWM module
+    iowrite32(ioread32(PWM + PWM_CTL) | PWM_CTL_PWEN1, PWM + PWM_CTL);
+    udelay(HW_DELAY_US);
+  }
 }
 
 
 /*
- * waits for any current DMA operation to complete then resets the DMA module
+ * looks up the DMA controller in the device tree. its device maps the buffers (bus addresses
+ * and cache maintenance) and gives the Linux interrupt number of channel 5 unless the dma_irq
+ * parameter is set. there is no fixed number to fall back on since device tree kernels hand
+ * out interrupt numbers dynamically. returns 0 on success or a negative error code.
  */
-static void dma_stop(void) {
-  // wait until any current DMA operation completes
-  while ((ioread32(DMA5 + DMA5_CS) & DMA5_CS_ACTIVE) && !(ioread32(DMA5 + DMA5_CS) & DMA5_CS_ERROR)) {
-    udelay(HW_DELAY_US);
+static int dma_dev_init(void) {
+  struct device_node *np;
+  np = of_find_compatible_node(NULL, NULL, DMA_COMPATIBLE);
+  if (!np) {
+    printk(KERN_ALERT "%s: (dma_dev_init) no %s node in the device tree\n", DRIVER_NAME, DMA_COMPATIBLE);
+    return -ENODEV;
+  }
+  dma_pdev = of_find_device_by_node(np);
+  of_node_put(np);
+  if (!dma_pdev) {
+    printk(KERN_ALERT "%s: (dma_dev_init) no device for the DMA controller\n", DRIVER_NAME);
+    return -ENODEV;
+  }
+  dma_dev = &dma_pdev->dev;
+  if (dma_irq) {
+    dma_irq_num = (dma_irq > 0) ? dma_irq : -EINVAL;
+  } else {
+    dma_irq_num = platform_get_irq(dma_pdev, DMA5_IRQ_INDEX);
+  }
+  if (dma_irq_num < 0) {
+    printk(KERN_ALERT "%s: (dma_dev_init) no DMA interrupt (%d)\n", DRIVER_NAME, dma_irq_num);
+    put_device(dma_dev);
+    dma_dev = NULL;
+    dma_pdev = NULL;
+    return dma_irq_num;
+  }
+  return 0;
+}
+
+
+/*
+ * DMA completion interrupt handler. clears the interrupt, latches any error and wakes up waiters
+ */
+static irqreturn_t dma_irq_handler(int irq, void *dev_id) {
+  uint32_t cs = ioread32(DMA5 + DMA5_CS);
+  // the line may be shared with other DMA channels
+  if (!(cs & (DMA5_CS_INT | DMA5_CS_ERROR))) {
+    return IRQ_NONE;
+  }
+  if (cs & DMA5_CS_ERROR) {
+    dma_err = ioread32(DMA5 + DMA5_DEBUG) & 0x7;
+  }
+  trace_ws281x_dma_irq(cs, dma_err);
+  // acknowledge the interrupt
+  iowrite32(DMA5_CS_INT, DMA5 + DMA5_CS);
+  wake_up_interruptible(&dma_waitq);
+  return IRQ_HANDLED;
+}
+
+
+/*
+ * returns non-zero once the DMA module is done with the current transfer
+ */
+static int dma_idle(void) {
+  uint32_t cs = ioread32(DMA5 + DMA5_CS);
+  return !(cs & DMA5_CS_ACTIVE) || (cs & DMA5_CS_ERROR);
+}
+
+
+/*
+ * sleeps until any current DMA operation completes. returns 0 on success, -EIO on a DMA error,
+ * -ETIMEDOUT if the transfer never finished or -ERESTARTSYS if interrupted by a signal
+ */
+static int dma_wait(void) {
+  long ret;
+  int err = 0;
+  // allow twice the wire time of a full buffer (3.2MHz or 2.4MHz bit rate) plus some slack
+  unsigned long timeout = usecs_to_jiffies((kbuf_len * 8 * 2) / (symbol_bits * WS281x_RATE / 1000000)) + msecs_to_jiffies(DMA_TIMEOUT_MS);
+  // registers are only read for the trace when it is enabled
+  if (trace_ws281x_dma_wait_enabled()) {
+    trace_ws281x_dma_wait(ioread32(DMA5 + DMA5_CS));
   }
-  // check for errors
-  if (ioread32(DMA5 + DMA5_CS) & DMA5_CS_ERROR) {
-    printk(KERN_ALERT "%s: (dma_stop) DMA ERROR 0x%x\n", DRIVER_NAME, ioread32(DMA5 + DMA5_DEBUG) & 0x7);
+  // the completion interrupt wakes us up and the condition is re-checked against the hardware
+  ret = wait_event_interruptible_timeout(dma_waitq, dma_idle(), timeout);
+  if (ret < 0) {
+    err = ret;
+  } else if (!ret) {
+    printk(KERN_ALERT "%s: (dma_wait) DMA timeout CS 0x%x\n", DRIVER_NAME, ioread32(DMA5 + DMA5_CS));
+    stats_dma_error(STATS_DMA_TIMEOUT);
+    err = -ETIMEDOUT;
+  } else if ((ioread32(DMA5 + DMA5_CS) & DMA5_CS_ERROR) || dma_err) {
+    // DMA error
+    dma_err |= ioread32(DMA5 + DMA5_DEBUG) & 0x7;
+    printk(KERN_ALERT "%s: (dma_wait) DMA ERROR 0x%x\n", DRIVER_NAME, dma_err);
+    if (dma_err & DMA5_DEBUG_READ_LAST_NOT_SET_ERROR) {
+      stats_dma_error(STATS_DMA_READ_LAST_NOT_SET);
+    }
+    if (dma_err & DMA5_DEBUG_FIFO_ERROR) {
+      stats_dma_error(STATS_DMA_FIFO);
+    }
+    if (dma_err & DMA5_DEBUG_READ_ERROR) {
+      stats_dma_error(STATS_DMA_READ);
+    }
+    dma_err = 0;
+    err = -EIO;
   }
+  if (trace_ws281x_dma_done_enabled()) {
+    trace_ws281x_dma_done(ioread32(DMA5 + DMA5_CS), ioread32(DMA5 + DMA5_DEBUG), err);
+  }
+  return err;
+}
+
+
+/*
+ * resets the DMA module and clears any old status/error flags
+ */
+static void dma_reset(void) {
   // reset the DMA module
   iowrite32(DMA5_CS_RESET, DMA5 + DMA5_CS);
   udelay(HW_DELAY_US);
@@ -144,11 +336,21 @@ static void dma_stop(void) {
 
 
 /*
- * takes a complete control block and issues it to the DMA module
+ * waits for any current DMA operation to complete then resets the DMA module
+ */
+static void dma_stop(void) {
+  dma_wait();
+  dma_reset();
+}
+
+
+/*
+ * takes the bus address of a complete control block and issues it to the DMA module
  */
-static void dma_start(void) {
-  // set the new DMA control block physical address
-  iowrite32((uint32_t)virt_to_phys(dma_cb), DMA5 + DMA5_CONBLK_AD);
+static void dma_start(dma_addr_t cb) {
+  // set the new DMA control block bus address (the write barrier of iowrite32() makes the
+  // control blocks written before visible to the DMA module)
+  iowrite32((uint32_t)cb, DMA5 + DMA5_CONBLK_AD);
   udelay(HW_DELAY_US);
   // begin the DMA transfer with max AXI priority (15)
   iowrite32(DMA5_CS_WAIT_OUTSTANDING_WRITES | DMA5_CS_PANIC_PRIORITY(15) | DMA5_CS_PRIORITY(15) | DMA5_CS_ACTIVE, DMA5 + DMA5_CS);
@@ -156,80 +358,531 @@ static void dma_start(void) {
 }
 
 
+/*
+ * returns control block i of an encoded buffer (the tail control block is i = num_pages)
+ */
+static struct dma_cb_t *dmabuf_cb(struct dma_buf_t *buf, unsigned int i) {
+  return &buf->cb[i / CBS_PER_PAGE][i % CBS_PER_PAGE];
+}
+
+
+/*
+ * returns the bus address of control block i of an encoded buffer
+ */
+static dma_addr_t dmabuf_cb_dma(struct dma_buf_t *buf, unsigned int i) {
+  return buf->cb_dma[i / CBS_PER_PAGE] + ((i % CBS_PER_PAGE) * sizeof(struct dma_cb_t));
+}
+
+
+/*
+ * frees an encoded buffer, its pages and its control blocks
+ */
+static void dmabuf_free(struct dma_buf_t *buf) {
+  unsigned int i;
+  if (buf->virt) {
+    vunmap(buf->virt);
+  }
+  for (i = 0; i < buf->num_mapped; i++) {
+    dma_unmap_page(dma_dev, buf->page_dma[i], PAGE_SIZE, DMA_TO_DEVICE);
+  }
+  if (buf->pages) {
+    for (i = 0; i < buf->num_pages; i++) {
+      if (buf->pages[i]) {
+        __free_page(buf->pages[i]);
+      }
+    }
+    kfree(buf->pages);
+  }
+  if (buf->cb) {
+    for (i = 0; i < buf->num_cb_pages; i++) {
+      if (buf->cb[i]) {
+        dma_free_coherent(dma_dev, PAGE_SIZE, buf->cb[i], buf->cb_dma[i]);
+      }
+    }
+    kfree(buf->cb);
+  }
+  kfree(buf->cb_dma);
+  kfree(buf->page_dma);
+  memset(buf, 0, sizeof(*buf));
+}
+
+
+/*
+ * allocates a zeroed encoded buffer from single pages and chains one control block per page,
+ * followed by a tail control block that sends the RESET signal and raises the completion
+ * interrupt. returns 0 on success or -ENOMEM.
+ *
+ * buf - buffer to allocate
+ * len - length in bytes of the encoded data
+ */
+static int dmabuf_alloc(struct dma_buf_t *buf, size_t len) {
+  unsigned int i;
+  struct dma_cb_t *cb;
+  memset(buf, 0, sizeof(*buf));
+  buf->num_pages = DIV_ROUND_UP(len, PAGE_SIZE);
+  buf->num_cb_pages = DIV_ROUND_UP(buf->num_pages + 1, CBS_PER_PAGE);
+  buf->pages = kcalloc(buf->num_pages, sizeof(struct page *), GFP_KERNEL);
+  buf->page_dma = kcalloc(buf->num_pages, sizeof(dma_addr_t), GFP_KERNEL);
+  buf->cb = kcalloc(buf->num_cb_pages, sizeof(struct dma_cb_t *), GFP_KERNEL);
+  buf->cb_dma = kcalloc(buf->num_cb_pages, sizeof(dma_addr_t), GFP_KERNEL);
+  if (!buf->pages || !buf->page_dma || !buf->cb || !buf->cb_dma) {
+    dmabuf_free(buf);
+    return -ENOMEM;
+  }
+  // only order 0 allocations, so fragmented memory does not matter
+  for (i = 0; i < buf->num_pages; i++) {
+    buf->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!buf->pages[i]) {
+      dmabuf_free(buf);
+      return -ENOMEM;
+    }
+    buf->page_dma[i] = dma_map_page(dma_dev, buf->pages[i], 0, PAGE_SIZE, DMA_TO_DEVICE);
+    if (dma_mapping_error(dma_dev, buf->page_dma[i])) {
+      dmabuf_free(buf);
+      return -ENOMEM;
+    }
+    buf->num_mapped++;
+  }
+  for (i = 0; i < buf->num_cb_pages; i++) {
+    buf->cb[i] = (struct dma_cb_t *)dma_alloc_coherent(dma_dev, PAGE_SIZE, &buf->cb_dma[i], GFP_KERNEL);
+    if (!buf->cb[i]) {
+      dmabuf_free(buf);
+      return -ENOMEM;
+    }
+  }
+  // the encoder sees one contiguous buffer
+  buf->virt = (char *)vmap(buf->pages, buf->num_pages, VM_MAP, PAGE_KERNEL);
+  if (!buf->virt) {
+    dmabuf_free(buf);
+    return -ENOMEM;
+  }
+  for (i = 0; i < buf->num_pages; i++) {
+    cb = dmabuf_cb(buf, i);
+    // configure DMA control block transfer info for:
+    // - 32 bit transfers to peripheral 5 (PWM)
+    // - increment source address after each transfer
+    // - wait for response before next transfer (use destination DREQ)
+    cb->ti = DMA5_TI_NO_WIDE_BURSTS | DMA5_TI_PERMAP(5) | DMA5_TI_SRC_INC | DMA5_TI_DEST_DREQ | DMA5_TI_WAIT_RESP;
+    // stream the page into the PWM FIFO
+    cb->source_ad = (uint32_t)buf->page_dma[i];
+    cb->dest_ad = BUS_ADDRESS(PWM_BASE + (PWM_FIF1 * sizeof(uint32_t)));
+    cb->txfr_len = PAGE_SIZE;
+    cb->stride = 0;
+    cb->nextconbk = (uint32_t)dmabuf_cb_dma(buf, i + 1);
+  }
+  // the tail control block sends the RESET signal and reports the end of the frame
+  cb = dmabuf_cb(buf, buf->num_pages);
+  cb->ti = DMA5_TI_NO_WIDE_BURSTS | DMA5_TI_PERMAP(5) | DMA5_TI_SRC_INC | DMA5_TI_DEST_DREQ | DMA5_TI_WAIT_RESP | DMA5_TI_INTEN;
+  cb->source_ad = (uint32_t)reset_dma;
+  cb->dest_ad = BUS_ADDRESS(PWM_BASE + (PWM_FIF1 * sizeof(uint32_t)));
+  cb->txfr_len = reset_len;
+  cb->stride = 0;
+  cb->nextconbk = 0;
+  return 0;
+}
+
+
+/*
+ * makes the encoded data written through the contiguous mapping visible to the DMA module and
+ * shortens the chain to send only the first len bytes before the tail control block
+ *
+ * buf - encoded buffer
+ * len - number of encoded bytes to send (at least 1)
+ */
+static void dmabuf_prepare(struct dma_buf_t *buf, size_t len) {
+  unsigned int i, last = (len - 1) / PAGE_SIZE;
+  struct dma_cb_t *cb;
+  // the encoder wrote through the vmap() alias, which the DMA API does not know about, so that
+  // one is written back first and then the pages are handed to the device
+  flush_kernel_vmap_range(buf->virt, len);
+  for (i = 0; i <= last; i++) {
+    cb = dmabuf_cb(buf, i);
+    cb->txfr_len = (i < last) ? PAGE_SIZE : len - (last * PAGE_SIZE);
+    cb->nextconbk = (uint32_t)dmabuf_cb_dma(buf, (i < last) ? i + 1 : buf->num_pages);
+    dma_sync_single_for_device(dma_dev, buf->page_dma[i], cb->txfr_len, DMA_TO_DEVICE);
+  }
+}
+
+
+/*
+ * lays out the strips, allocates their encoded buffers and control blocks and switches the PWM
+ * and the output pins over to them. returns 0 on success or a negative error code.
+ */
+static int strip_init(void) {
+  int i;
+  // only pins that the GPIO block has can be used
+  if (pin_num < 0 || pin_num >= GPIO_NUM_PINS || pin_fun < 0 || pin_fun >= GPIO_NUM_FUNS ||
+      (num_leds2 > 0 && (pin_num2 < 0 || pin_num2 >= GPIO_NUM_PINS || pin_fun2 < 0 || pin_fun2 >= GPIO_NUM_FUNS))) {
+    printk(KERN_ALERT "%s: (strip_init) invalid GPIO pin %d/%d or function %d/%d\n", DRIVER_NAME, pin_num, pin_num2, pin_fun, pin_fun2);
+    return -EINVAL;
+  }
+  // lay out the pixel data of each strip in the frame
+  i = kbuf_init();
+  if (i) {
+    return i;
+  }
+  // the RESET signal is sent on every channel
+  reset_len = ROUND_UP(WS281x_RESET_PADDING(symbol_bits) * kbuf_chans, sizeof(uint32_t));
+  for (i = 0; i < NUM_KBUFS; i++) {
+    // allocate the buffer needed for streaming user data to the PWM module
+    if (dmabuf_alloc(&kbuf[i], kbuf_len)) {
+      printk(KERN_ALERT "%s: (strip_init) allocation error for %zu encoded bytes\n", DRIVER_NAME, kbuf_len);
+      return -ENOMEM;
+    }
+  }
+  kbuf_idx = 0;
+  // restart the PWM generation for the number of channels in use
+  pwm_stop();
+  pwm_start();
+  // configure GPIO pin(s) to the correct function for PWM output
+  gpio_config(pin_num, pin_fun);
+  strip_pin[0] = pin_num;
+  if (kbuf_chans > 1) {
+    gpio_config(pin_num2, pin_fun2);
+    strip_pin[1] = pin_num2;
+  }
+  strip_ready = 1;
+  return 0;
+}
+
+
+/*
+ * stops any transfer and frees what strip_init() set up. the LEDs keep what they latched.
+ */
+static void strip_cleanup(void) {
+  int i;
+  strip_ready = 0;
+  hal_stop();
+  dma_stop();
+  // the pins stop driving the LEDs before the PWM is reconfigured
+  for (i = 0; i < NUM_CHANS; i++) {
+    if (strip_pin[i] >= 0) {
+      gpio_release(strip_pin[i]);
+      strip_pin[i] = -1;
+    }
+  }
+  for (i = 0; i < NUM_KBUFS; i++) {
+    dmabuf_free(&kbuf[i]);
+  }
+  for (i = 0; i < WS281x_MAX_SLOTS; i++) {
+    dmabuf_free(&slot_buf[i]);
+  }
+  kbuf_cleanup();
+}
+
+
 int hal_init(void) {
+  int err = -ENOMEM;
   // map external IO
   CM = (volatile uint32_t *)ioremap(CM_BASE, CM_SIZE);
   PWM = (volatile uint32_t *)ioremap(PWM_BASE, PWM_SIZE);
   DMA5 = (volatile uint32_t *)ioremap(DMA5_BASE, DMA5_SIZE);
   GPIO = (volatile uint32_t *)ioremap(GPIO_BASE, GPIO_SIZE);
-  // allocate space for the control block
-  dma_cb = (struct dma_cb_t *)__get_free_pages(GFP_KERNEL, sizeof(struct dma_cb_t) / PAGE_SIZE);
-  if (IS_ERR(dma_cb)) {
-    printk(KERN_ALERT "%s: (hal_init) __get_free_pages error 0x%p\n", DRIVER_NAME, dma_cb);
+  if (!CM || !PWM || !DMA5 || !GPIO) {
+    printk(KERN_ALERT "%s: (hal_init) ioremap error\n", DRIVER_NAME);
+    goto err_unmap;
+  }
+  // build the pixel encoding table from the PWM symbols
+  if (symbol_bits == 3) {
+    encoder_init(WS281x_1_3BIT, WS281x_0_3BIT, 3);
+  } else {
+    encoder_init(WS281x_1, WS281x_0, BYTES_PER_WS281x);
+  }
+  // every buffer is mapped for the DMA controller and its interrupt comes from the device tree
+  err = dma_dev_init();
+  if (err) {
+    goto err_unmap;
+  }
+  // allocate the zero buffer for the WS281x RESET signal (long enough for every channel)
+  reset_buf = (char *)dma_alloc_coherent(dma_dev, PAGE_SIZE, &reset_dma, GFP_KERNEL);
+  if (!reset_buf) {
+    printk(KERN_ALERT "%s: (hal_init) dma_alloc_coherent error\n", DRIVER_NAME);
+    err = -ENOMEM;
+    goto err_put_dev;
+  }
+  // put the DMA module into a known state and hook up the completion interrupt
+  dma_reset();
+  dma_err = 0;
+  err = request_irq(dma_irq_num, dma_irq_handler, IRQF_SHARED, DRIVER_NAME, &dma_waitq);
+  if (err) {
+    printk(KERN_ALERT "%s: (hal_init) request_irq %d error %d\n", DRIVER_NAME, dma_irq_num, err);
+    goto err_free_reset;
+  }
+  // everything above stays up until the module is unloaded, the strips can be laid out again
+  err = strip_init();
+  if (err) {
+    goto err_free_strip;
+  }
+  return 0;
+
+err_free_strip:
+  // frees whatever strip_init() got to
+  strip_cleanup();
+  free_irq(dma_irq_num, &dma_waitq);
+  pwm_stop();
+err_free_reset:
+  dma_free_coherent(dma_dev, PAGE_SIZE, reset_buf, reset_dma);
+err_put_dev:
+  put_device(dma_dev);
+  dma_dev = NULL;
+  dma_pdev = NULL;
+err_unmap:
+  // any of the mappings may have failed
+  if (GPIO) {
+    iounmap(GPIO);
+  }
+  if (DMA5) {
+    iounmap(DMA5);
+  }
+  if (PWM) {
+    iounmap(PWM);
+  }
+  if (CM) {
+    iounmap(CM);
+  }
+  GPIO = DMA5 = PWM = CM = NULL;
+  return err;
+}
+
+
+int hal_configure(void) {
+  int err;
+  strip_cleanup();
+  err = strip_init();
+  if (err) {
+    // frees whatever strip_init() got to, nothing is sent until the next layout works
+    strip_cleanup();
+  }
+  return err;
+}
+
+
+/*
+ * frees the buffers and control blocks of an animation
+ */
+static void anim_free(void) {
+  unsigned int i;
+  if (anim_buf) {
+    for (i = 0; i < anim_frames; i++) {
+      dmabuf_free(&anim_buf[i]);
+    }
+    kfree(anim_buf);
+  }
+  anim_buf = NULL;
+  anim_frames = 0;
+}
+
+
+void hal_invalidate(size_t start, size_t len) {
+  kbuf_invalidate(start, len);
+}
+
+
+int hal_ready(void) {
+  return anim_active || dma_idle();
+}
+
+
+void hal_poll_wait(struct file *filep, poll_table *wait) {
+  // the completion interrupt wakes this queue at the end of every frame
+  poll_wait(filep, &dma_waitq, wait);
+}
+
+
+void hal_set_lut(const uint8_t lut[][256]) {
+  // the table is folded into the encode tables, so everything has to be encoded again
+  encoder_set_lut(lut);
+  kbuf_invalidate(0, kbuf_frame_len);
+}
+
+
+int hal_render(const char *buf, size_t len) {
+  int err;
+  u64 t;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  // a new frame ends any animation that is playing
+  hal_stop();
+  // re-encode the changed pixels into the idle buffer while the other one may still be streaming
+  len = kbuf_encode(kbuf[kbuf_idx].virt, kbuf_idx, buf, len);
+  // nothing changed since the last frame so the LEDs are already up to date
+  if (!len) {
+    return 0;
+  }
+  dmabuf_prepare(&kbuf[kbuf_idx], len);
+  // sleep until the DMA transfer of the previous frame finishes
+  t = ktime_get_ns();
+  err = dma_wait();
+  stats_wait(ktime_get_ns() - t);
+  if (err == -ERESTARTSYS) {
+    return err;
+  }
+  dma_reset();
+  if (err) {
+    return err;
+  }
+  // send the idle buffer's control block chain to DMA for transfer and swap buffers
+  dma_start(dmabuf_cb_dma(&kbuf[kbuf_idx], 0));
+  if (trace_ws281x_dma_start_enabled()) {
+    trace_ws281x_dma_start(kbuf_idx, len, ioread32(DMA5 + DMA5_CS));
+  }
+  kbuf_idx = (kbuf_idx + 1) % NUM_KBUFS;
+  kbuf_sent();
+  return 0;
+}
+
+
+int hal_play(const char *frames, unsigned int num_frames, unsigned int frame_us, int loop) {
+  unsigned int i;
+  u64 period, gap;
+  int err;
+  struct dma_cb_t *cb;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  // the line is held low after every frame for the RESET signal and the rest of the frame period
+  // (round_up() since the 64 bit gap can not be divided on 32 bit ARM)
+  period = div_u64((u64)frame_us * symbol_bits * WS281x_RATE, 8 * USEC_PER_SEC);
+  gap = (period > kbuf_len + reset_len) ? round_up(period - kbuf_len, sizeof(uint32_t)) : reset_len;
+  // the spacer is a single control block
+  if (gap > DMA5_TXFR_LEN_MAX) {
+    return -EINVAL;
+  }
+  // the new animation replaces the one playing and waits for any frame still being sent
+  hal_stop();
+  err = dma_wait();
+  if (err == -ERESTARTSYS) {
+    return err;
+  }
+  dma_reset();
+  anim_frames = num_frames;
+  anim_buf = kcalloc(num_frames, sizeof(struct dma_buf_t), GFP_KERNEL);
+  if (!anim_buf) {
+    printk(KERN_ALERT "%s: (hal_play) allocation error for %u frames\n", DRIVER_NAME, num_frames);
+    anim_free();
     return -ENOMEM;
   }
-  // zero out the control block
-  memset(dma_cb, 0, sizeof(struct dma_cb_t));
-  // find out how many bytes are needed in the buffer
-  kbuf_len = ROUND_UP((num_leds * WS281x_DATA_LEN * BYTES_PER_WS281x) + WS281x_RESET_PADDING(BYTES_PER_WS281x), sizeof(uint32_t));
-  // allocate the buffer needed for streaming user data to the PWM module
-  kbuf = (char *)__get_free_pages(GFP_KERNEL, kbuf_len / PAGE_SIZE);
-  if (IS_ERR(kbuf)) {
-    printk(KERN_INFO "%s: (hal_init) __get_free_pages error 0x%p\n", DRIVER_NAME, kbuf);
+  for (i = 0; i < num_frames; i++) {
+    // every frame is encoded once up front into its own DMA buffer
+    if (dmabuf_alloc(&anim_buf[i], kbuf_len)) {
+      printk(KERN_ALERT "%s: (hal_play) allocation error for frame %u\n", DRIVER_NAME, i);
+      anim_free();
+      return -ENOMEM;
+    }
+    kbuf_encode_frame(anim_buf[i].virt, frames + (i * kbuf_frame_len));
+    dmabuf_prepare(&anim_buf[i], kbuf_len);
+  }
+  for (i = 0; i < num_frames; i++) {
+    // RESET/spacer without a source increment so any length keeps re-reading the zero buffer
+    cb = dmabuf_cb(&anim_buf[i], anim_buf[i].num_pages);
+    cb->ti = DMA5_TI_NO_WIDE_BURSTS | DMA5_TI_PERMAP(5) | DMA5_TI_DEST_DREQ | DMA5_TI_WAIT_RESP;
+    cb->txfr_len = (uint32_t)gap;
+    if (i + 1 < num_frames) {
+      cb->nextconbk = (uint32_t)dmabuf_cb_dma(&anim_buf[i + 1], 0);
+    } else if (loop) {
+      cb->nextconbk = (uint32_t)dmabuf_cb_dma(&anim_buf[0], 0);
+    } else {
+      // the last block of a one shot animation reports its end
+      cb->ti |= DMA5_TI_INTEN;
+      cb->nextconbk = 0;
+    }
+  }
+  anim_active = 1;
+  dma_start(dmabuf_cb_dma(&anim_buf[0], 0));
+  return 0;
+}
+
+
+void hal_stop(void) {
+  if (!anim_active) {
+    return;
+  }
+  // abort the chain wherever it is, the LEDs keep what they latched
+  dma_reset();
+  anim_free();
+  anim_active = 0;
+  // the ping-pong buffers no longer match what the LEDs show so the next frame is sent whole
+  kbuf_invalidate(0, kbuf_frame_len);
+}
+
+
+int hal_anim_frame(void) {
+  uint32_t conbk;
+  unsigned int i, j;
+  if (!anim_active) {
+    return -1;
+  }
+  // the control block being processed belongs to one frame, either its data or the spacer after it
+  conbk = ioread32(DMA5 + DMA5_CONBLK_AD);
+  for (i = 0; i < anim_frames; i++) {
+    for (j = 0; j < anim_buf[i].num_cb_pages; j++) {
+      if ((conbk & PAGE_MASK) == (uint32_t)anim_buf[i].cb_dma[j]) {
+        return i;
+      }
+    }
+  }
+  // an animation that does not loop stops on its last frame
+  return anim_frames - 1;
+}
+
+
+int hal_slot_store(unsigned int slot, const char *buf) {
+  int err;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  if (slot_buf[slot].virt && !anim_active) {
+    // the slot may be streaming right now
+    err = dma_wait();
+    if (err == -ERESTARTSYS) {
+      return err;
+    }
+  }
+  if (!slot_buf[slot].virt && dmabuf_alloc(&slot_buf[slot], kbuf_len)) {
+    printk(KERN_ALERT "%s: (hal_slot_store) allocation error for slot %u\n", DRIVER_NAME, slot);
     return -ENOMEM;
   }
-  // store the physical address of the empty PWM buffer into the DMA control block
-  dma_cb->source_ad = (uint32_t)virt_to_phys(kbuf);
-  // set the destination address to be the hardware buss address of the PWM FIFO
-  dma_cb->dest_ad = BUS_ADDRESS(PWM_BASE + (PWM_FIF1 * sizeof(uint32_t)));
-  // set the total number of bytes to transfer
-  dma_cb->txfr_len = kbuf_len;
-  // configure DMA control block transfer info for:
-  // - 32 bit transfers to peripheral 5 (PWM)
-  // - increment source address after each transfer
-  // - wait for response before next transfer (use destination DREQ)
-  dma_cb->ti = DMA5_TI_NO_WIDE_BURSTS | DMA5_TI_PERMAP(5) | DMA5_TI_SRC_INC | DMA5_TI_DEST_DREQ | DMA5_TI_WAIT_RESP;
-  // no 2D stride and make sure there is no other chained control block
-  dma_cb->stride = 0;
-  dma_cb->nextconbk = 0;
-  // stop the clock if it is in use
-  pwm_stop();
-  // start the PWM generation
-  pwm_start();
-  // configure GPIO pin to the correct function for PWM output
-  gpio_config(pin_num, pin_fun);
+  kbuf_encode_frame(slot_buf[slot].virt, buf);
+  dmabuf_prepare(&slot_buf[slot], kbuf_len);
   return 0;
 }
 
 
-void hal_render(const char *buf, size_t len) {
-  int i, j;
-  // wait for any DMA transfer in progress to finish
-  dma_stop();
-  // convert the user buffer into the PWM buffer
-  j = 0;
-  for (i = 0, j = 0; i < len; i++, j+=BYTES_PER_WS281x) {
-    kbuf[j + 3]  = (buf[i] & (1 << 7)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
-    kbuf[j + 3] |= (buf[i] & (1 << 6)) ? WS281x_1 : WS281x_0;
-    kbuf[j + 2]  = (buf[i] & (1 << 5)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
-    kbuf[j + 2] |= (buf[i] & (1 << 4)) ? WS281x_1 : WS281x_0;
-    kbuf[j + 1]  = (buf[i] & (1 << 3)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
-    kbuf[j + 1] |= (buf[i] & (1 << 2)) ? WS281x_1 : WS281x_0;
-    kbuf[j + 0]  = (buf[i] & (1 << 1)) ? (WS281x_1 << 4) : (WS281x_0 << 4);
-    kbuf[j + 0] |= (buf[i] & (1 << 0)) ? WS281x_1 : WS281x_0;
+int hal_slot_show(unsigned int slot) {
+  int err;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  if (!slot_buf[slot].virt) {
+    return -ENOENT;
+  }
+  hal_stop();
+  err = dma_wait();
+  if (err == -ERESTARTSYS) {
+    return err;
   }
-  // zero out remaining space for the WS281x RESET signal
-  memset(kbuf + j, 0, (dma_cb->txfr_len) - j);
-  // send the control block to DMA for transfer
-  dma_start();
+  dma_reset();
+  if (err) {
+    return err;
+  }
+  // nothing is encoded or copied, the slot's own control block chain is handed to the DMA module
+  dma_start(dmabuf_cb_dma(&slot_buf[slot], 0));
+  stats_frame();
+  // the ping-pong buffers no longer match what the LEDs show so the next frame is sent whole
+  kbuf_invalidate(0, kbuf_frame_len);
+  return 0;
 }
 
 
 void hal_cleanup(void) {
-  dma_stop();
+  strip_cleanup();
+  free_irq(dma_irq_num, &dma_waitq);
   pwm_stop();
-  free_pages((uint32_t)kbuf, kbuf_len / PAGE_SIZE);
-  free_pages((uint32_t)dma_cb, sizeof(struct dma_cb_t) / PAGE_SIZE);
+  dma_free_coherent(dma_dev, PAGE_SIZE, reset_buf, reset_dma);
+  put_device(dma_dev);
+  dma_dev = NULL;
+  dma_pdev = NULL;
   iounmap(CM);
   iounmap(PWM);
   iounmap(DMA5);
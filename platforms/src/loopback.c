@@ -0,0 +1,413 @@
+/*
+ * loopback.c
+ *
+ * Simulated platform used to measure and test the driver without Raspberry Pi hardware.
+ * Frames are encoded into the same buffers as on real hardware, the "transfer" completes
+ * after the real wire time using an hrtimer and the transmitted waveform plus the pixel
+ * colors a strip would show are exposed through debugfs:
+ *
+ * /sys/kernel/debug/ws281x/loopback/waveform - encoded bytes of the last frame (including RESET)
+ * /sys/kernel/debug/ws281x/loopback/pixels - pixel data latched by the simulated strip(s) in wire order
+ * /sys/kernel/debug/ws281x/loopback/frames - number of frames sent
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h>  /* for printk KERN_INFO */
+#include <linux/string.h>  /* for memset() */
+#include <linux/vmalloc.h> /* for vzalloc() */
+#include <linux/hrtimer.h> /* for the simulated transfer */
+#include <linux/workqueue.h> /* for capturing animation frames */
+#include <linux/ktime.h>   /* for ns_to_ktime() */
+#include <linux/wait.h>    /* for wait queues */
+#include <linux/debugfs.h> /* for exposing the captured output */
+#include <asm/errno.h>     /* for linux error return codes */
+
+#include <hal.h>           /* for interface definition and ROUND_UP */
+#include <encoder.h>       /* for the table driven pixel encoder */
+#include <stats.h>         /* for performance counters and the debugfs directory */
+#include <kbuf.h>          /* for the encoded buffer bookkeeping */
+#include <WS281x_trace.h>  /* for tracepoints */
+#include <WS281x.h>        /* for WS281x macros and user parameters */
+#include <WS281x_ioctl.h>  /* for WS281x_MAX_SLOTS */
+#include <loopback.h>      /* for platform specific constants */
+
+/* internal ping-pong buffers (kbuf_len bytes each) */
+static char *kbuf[NUM_KBUFS];
+
+/* index of the idle buffer that the next frame is encoded into */
+static int kbuf_idx;
+
+/* non-zero while the strips are laid out (a failed hal_configure() leaves none) */
+static int strip_ready;
+
+/* length of the simulated WS281x RESET signal */
+static uint32_t reset_len;
+
+/* timer that completes the simulated transfer and the wait queue it wakes */
+static struct hrtimer wire_timer;
+static int wire_busy;
+static DECLARE_WAIT_QUEUE_HEAD(wire_waitq);
+
+/* captured output of the last frame and the pixel data latched by the simulated strip(s) */
+static char *wire_buf;
+static char *strip_buf;
+static size_t strip_len;
+static struct debugfs_blob_wrapper wire_blob;
+static struct debugfs_blob_wrapper strip_blob;
+static uint32_t frames_sent;
+static struct dentry *debug_dir;
+
+/* pre-encoded frames stored with hal_slot_store() (kbuf_len bytes each) */
+static char *slot_buf[WS281x_MAX_SLOTS];
+
+/* animation played by hal_play(): encoded frames back to back (kbuf_len bytes each) */
+static char *anim_buf;
+static unsigned int anim_frames;
+static unsigned int anim_idx;
+static int anim_loop;
+static int anim_active;
+static u64 anim_period_ns;
+
+/* captures the animation frame being sent outside of the timer callback */
+static struct work_struct anim_work;
+
+
+/*
+ * captures an encoded frame as it goes out on the wire and latches the pixels that it reaches
+ *
+ * src - encoded buffer
+ * len - number of encoded bytes sent
+ */
+static void wire_capture(const char *src, size_t len) {
+  int i;
+  size_t words, off;
+  // capture what goes out on the wire, followed by the RESET padding
+  memcpy(wire_buf, src, len);
+  memset(wire_buf + len, 0, reset_len);
+  wire_blob.size = len + reset_len;
+  // pixels latch the bits that reach them and keep their color past the end of the frame
+  words = len / ENCODER_WORD_LEN / kbuf_chans;
+  for (i = 0, off = 0; i < kbuf_chans; off += kbuf_chan_leds[i] * encoder_wire_len(), i++) {
+    encoder_decode((uint8_t *)strip_buf + off, (const uint32_t *)src + i, min(encoder_pixels(words), kbuf_chan_leds[i]) * encoder_wire_len(), kbuf_chans);
+  }
+}
+
+
+/*
+ * captures the animation frame being sent. frames that are sent before the work item gets to
+ * run are not captured, the output always shows the latest one.
+ */
+static void anim_work_fn(struct work_struct *work) {
+  wire_capture(anim_buf + (READ_ONCE(anim_idx) * kbuf_len), kbuf_len);
+}
+
+
+/*
+ * completes the simulated transfer, or sends the next frame of an animation
+ */
+static enum hrtimer_restart wire_timer_fn(struct hrtimer *timer) {
+  if (anim_active && (anim_idx + 1 < anim_frames || anim_loop)) {
+    WRITE_ONCE(anim_idx, (anim_idx + 1) % anim_frames);
+    frames_sent++;
+    // copying and decoding a whole frame with interrupts off would skew the timing being
+    // measured, so that is left to a work item
+    schedule_work(&anim_work);
+    hrtimer_forward_now(timer, ns_to_ktime(anim_period_ns));
+    return HRTIMER_RESTART;
+  }
+  // there are no DMA registers, the busy flag stands in for the status
+  trace_ws281x_dma_irq(0, 0);
+  WRITE_ONCE(wire_busy, 0);
+  wake_up_interruptible(&wire_waitq);
+  return HRTIMER_NORESTART;
+}
+
+
+/*
+ * sleeps until the simulated transfer in flight completes. returns 0 or -ERESTARTSYS if interrupted.
+ */
+static int wire_wait(void) {
+  int err;
+  trace_ws281x_dma_wait(READ_ONCE(wire_busy));
+  err = wait_event_interruptible(wire_waitq, !READ_ONCE(wire_busy));
+  trace_ws281x_dma_done(READ_ONCE(wire_busy), 0, err);
+  return err;
+}
+
+
+/*
+ * "transmits" an encoded frame and schedules completion after the frame's wire time
+ *
+ * src - encoded buffer
+ * len - number of encoded bytes to send
+ */
+static void wire_start(const char *src, size_t len) {
+  wire_capture(src, len);
+  frames_sent++;
+  WRITE_ONCE(wire_busy, 1);
+  hrtimer_start(&wire_timer, ns_to_ktime((len + reset_len) * WIRE_NS_PER_BYTE(symbol_bits)), HRTIMER_MODE_REL);
+}
+
+
+/*
+ * lays out the strips and allocates their encoded buffers and the captured output. returns 0
+ * on success or a negative error code.
+ */
+static int strip_init(void) {
+  int i, err;
+  // lay out the pixel data of each strip in the frame
+  err = kbuf_init();
+  if (err) {
+    return err;
+  }
+  reset_len = ROUND_UP(WS281x_RESET_PADDING(symbol_bits) * kbuf_chans, sizeof(uint32_t));
+  // nothing is handed to a DMA engine so plain virtual memory is enough
+  for (i = 0; i < NUM_KBUFS; i++) {
+    kbuf[i] = (char *)vzalloc(kbuf_len);
+  }
+  wire_buf = (char *)vzalloc(kbuf_len + reset_len);
+  strip_len = (kbuf_chan_leds[0] + kbuf_chan_leds[1]) * encoder_wire_len();
+  strip_buf = (char *)vzalloc(strip_len);
+  if (!kbuf[0] || !kbuf[1] || !wire_buf || !strip_buf) {
+    printk(KERN_ALERT "%s: (strip_init) vzalloc error\n", DRIVER_NAME);
+    return -ENOMEM;
+  }
+  kbuf_idx = 0;
+  // expose the captured output
+  wire_blob.data = wire_buf;
+  wire_blob.size = 0;
+  strip_blob.data = strip_buf;
+  strip_blob.size = strip_len;
+  printk(KERN_INFO "%s: (strip_init) loopback platform with %d channel(s)\n", DRIVER_NAME, kbuf_chans);
+  strip_ready = 1;
+  return 0;
+}
+
+
+/*
+ * stops any transfer and frees what strip_init() set up
+ */
+static void strip_cleanup(void) {
+  int i;
+  strip_ready = 0;
+  hal_stop();
+  hrtimer_cancel(&wire_timer);
+  WRITE_ONCE(wire_busy, 0);
+  wire_blob.size = 0;
+  strip_blob.size = 0;
+  for (i = 0; i < NUM_KBUFS; i++) {
+    vfree(kbuf[i]);
+    kbuf[i] = NULL;
+  }
+  for (i = 0; i < WS281x_MAX_SLOTS; i++) {
+    vfree(slot_buf[i]);
+    slot_buf[i] = NULL;
+  }
+  vfree(wire_buf);
+  vfree(strip_buf);
+  wire_buf = NULL;
+  strip_buf = NULL;
+  kbuf_cleanup();
+}
+
+
+int hal_init(void) {
+  int err;
+  hrtimer_init(&wire_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  wire_timer.function = wire_timer_fn;
+  INIT_WORK(&anim_work, anim_work_fn);
+  // build the pixel encoding table from the symbols
+  if (symbol_bits == 3) {
+    encoder_init(WS281x_1_3BIT, WS281x_0_3BIT, 3);
+  } else {
+    encoder_init(WS281x_1, WS281x_0, BYTES_PER_WS281x);
+  }
+  wire_busy = 0;
+  frames_sent = 0;
+  err = strip_init();
+  if (err) {
+    strip_cleanup();
+    return err;
+  }
+  // the files follow the captured output when the strips are laid out again
+  debug_dir = debugfs_create_dir(LOOPBACK_DEBUGFS_DIR, stats_debugfs_dir());
+  debugfs_create_blob("waveform", 0444, debug_dir, &wire_blob);
+  debugfs_create_blob("pixels", 0444, debug_dir, &strip_blob);
+  debugfs_create_u32("frames", 0444, debug_dir, &frames_sent);
+  return 0;
+}
+
+
+int hal_configure(void) {
+  int err;
+  strip_cleanup();
+  err = strip_init();
+  if (err) {
+    // frees whatever strip_init() got to, nothing is sent until the next layout works
+    strip_cleanup();
+  }
+  return err;
+}
+
+
+void hal_invalidate(size_t start, size_t len) {
+  kbuf_invalidate(start, len);
+}
+
+
+int hal_ready(void) {
+  return anim_active || !READ_ONCE(wire_busy);
+}
+
+
+void hal_poll_wait(struct file *filep, poll_table *wait) {
+  // the wire timer wakes this queue at the end of every simulated transfer
+  poll_wait(filep, &wire_waitq, wait);
+}
+
+
+void hal_set_lut(const uint8_t lut[][256]) {
+  // the table is folded into the encode tables, so everything has to be encoded again
+  encoder_set_lut(lut);
+  kbuf_invalidate(0, kbuf_frame_len);
+}
+
+
+int hal_render(const char *buf, size_t len) {
+  int err;
+  u64 t;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  // a new frame ends any animation that is playing
+  hal_stop();
+  // re-encode the changed pixels into the idle buffer while the other one may still be "streaming"
+  len = kbuf_encode(kbuf[kbuf_idx], kbuf_idx, buf, len);
+  // nothing changed since the last frame so the LEDs are already up to date
+  if (!len) {
+    return 0;
+  }
+  // sleep until the previous frame is done
+  t = ktime_get_ns();
+  err = wire_wait();
+  stats_wait(ktime_get_ns() - t);
+  if (err) {
+    return err;
+  }
+  // send the idle buffer and swap buffers
+  wire_start(kbuf[kbuf_idx], len);
+  trace_ws281x_dma_start(kbuf_idx, len, READ_ONCE(wire_busy));
+  kbuf_idx = (kbuf_idx + 1) % NUM_KBUFS;
+  kbuf_sent();
+  return 0;
+}
+
+
+int hal_play(const char *frames, unsigned int num_frames, unsigned int frame_us, int loop) {
+  unsigned int i;
+  int err;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  // the new animation replaces the one playing and waits for any frame still being sent
+  hal_stop();
+  err = wire_wait();
+  if (err) {
+    return err;
+  }
+  anim_buf = (char *)vzalloc((size_t)num_frames * kbuf_len);
+  if (!anim_buf) {
+    printk(KERN_ALERT "%s: (hal_play) vzalloc error for %u frames\n", DRIVER_NAME, num_frames);
+    return -ENOMEM;
+  }
+  // every frame is encoded once up front
+  for (i = 0; i < num_frames; i++) {
+    kbuf_encode_frame(anim_buf + (i * kbuf_len), frames + (i * kbuf_frame_len));
+  }
+  // a frame can not be shorter than its wire time plus the RESET signal
+  anim_period_ns = max((u64)(kbuf_len + reset_len) * WIRE_NS_PER_BYTE(symbol_bits), (u64)frame_us * NSEC_PER_USEC);
+  anim_frames = num_frames;
+  anim_loop = loop;
+  anim_idx = 0;
+  anim_active = 1;
+  wire_capture(anim_buf, kbuf_len);
+  frames_sent++;
+  WRITE_ONCE(wire_busy, 1);
+  hrtimer_start(&wire_timer, ns_to_ktime(anim_period_ns), HRTIMER_MODE_REL);
+  return 0;
+}
+
+
+void hal_stop(void) {
+  if (!anim_active) {
+    return;
+  }
+  // stop the timer wherever the animation is, the simulated LEDs keep what they latched
+  hrtimer_cancel(&wire_timer);
+  cancel_work_sync(&anim_work);
+  anim_active = 0;
+  vfree(anim_buf);
+  anim_buf = NULL;
+  WRITE_ONCE(wire_busy, 0);
+  wake_up_interruptible(&wire_waitq);
+  // the ping-pong buffers no longer match what the LEDs show so the next frame is sent whole
+  kbuf_invalidate(0, kbuf_frame_len);
+}
+
+
+int hal_anim_frame(void) {
+  return anim_active ? (int)anim_idx : -1;
+}
+
+
+int hal_slot_store(unsigned int slot, const char *buf) {
+  int err;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  if (slot_buf[slot] && !anim_active) {
+    // the slot may be "streaming" right now
+    err = wire_wait();
+    if (err) {
+      return err;
+    }
+  }
+  if (!slot_buf[slot]) {
+    slot_buf[slot] = (char *)vzalloc(kbuf_len);
+    if (!slot_buf[slot]) {
+      printk(KERN_ALERT "%s: (hal_slot_store) vzalloc error for slot %u\n", DRIVER_NAME, slot);
+      return -ENOMEM;
+    }
+  }
+  kbuf_encode_frame(slot_buf[slot], buf);
+  return 0;
+}
+
+
+int hal_slot_show(unsigned int slot) {
+  int err;
+  if (!strip_ready) {
+    return -ENODEV;
+  }
+  if (!slot_buf[slot]) {
+    return -ENOENT;
+  }
+  hal_stop();
+  err = wire_wait();
+  if (err) {
+    return err;
+  }
+  wire_start(slot_buf[slot], kbuf_len);
+  stats_frame();
+  // the ping-pong buffers no longer match what the LEDs show so the next frame is sent whole
+  kbuf_invalidate(0, kbuf_frame_len);
+  return 0;
+}
+
+
+void hal_cleanup(void) {
+  debugfs_remove_recursive(debug_dir);
+  debug_dir = NULL;
+  strip_cleanup();
+}
@@ -24,34 +24,22 @@ ws281x_leds = ws281x.LEDs(num_leds=30, pin_num=18, pin_fun=5, module_path="../..
 
 # will fade from color1 to color2 to color1 again
 def fade(delay, color1, color2):
-  # fade up then back down again
-  for x in range(2):
-    # for every brightness level
-    for y in xrange(254):
-      # for each LED
-      for led in xrange(ws281x_leds.getNumLEDs()):
-        if led % 2 == 0:
-          # even is color1
-          ws281x_leds.setColor(led, color1)
-        else:
-          # odd is color2
-          ws281x_leds.setColor(led, color2)
-      ws281x_leds.render()
-      sleep(delay)
-      if x == 0:
-        color1.setRed(0x00 if (color1.getRed() == 0x00) else (color1.getRed() - 1))
-        color1.setGreen(0x00 if (color1.getGreen() == 0x00) else (color1.getGreen() - 1))
-        color1.setBlue(0x00 if (color1.getBlue() == 0x00) else (color1.getBlue() - 1))
-        color2.setRed((color2.getRed() + 1) if (color2.getRed() > 0x00) else 0x00)
-        color2.setGreen((color2.getGreen() + 1) if (color2.getGreen() > 0x00) else 0x00)
-        color2.setBlue((color2.getBlue() + 1) if (color2.getBlue() > 0x00) else 0x00)
-      else:
-        color1.setRed((color1.getRed() + 1) if (color1.getRed() > 0x00) else 0x00)
-        color1.setGreen((color1.getGreen() + 1) if (color1.getGreen() > 0x00) else 0x00)
-        color1.setBlue((color1.getBlue() + 1) if (color1.getBlue() > 0x00) else 0x00)
-        color2.setRed(0x00 if (color2.getRed() == 0x00) else (color2.getRed() - 1))
-        color2.setGreen(0x00 if (color2.getGreen() == 0x00) else (color2.getGreen() - 1))
-        color2.setBlue(0x00 if (color2.getBlue() == 0x00) else (color2.getBlue() - 1))
+  # the two frames to fade between: even LEDs start at color1 and odd LEDs at color2, then they swap
+  ws281x_leds.fill(color2)
+  for led in xrange(0, ws281x_leds.getNumLEDs(), 2):
+    ws281x_leds.setColor(led, color1)
+  frame1 = ws281x_leds.getFrame()
+  ws281x_leds.fill(color1)
+  for led in xrange(0, ws281x_leds.getNumLEDs(), 2):
+    ws281x_leds.setColor(led, color2)
+  frame2 = ws281x_leds.getFrame()
+  ws281x_leds.setFrame(frame1)
+  ws281x_leds.render()
+  # fade up then back down again, the driver renders every step of each fade
+  for frame in (frame2, frame1):
+    ws281x_leds.setFrame(frame)
+    ws281x_leds.fade(int(delay * 255 * 1000), ws281x.EASE_IN_OUT)
+    sleep(delay * 255)
 
 # call the routine and fade back and forth a few times
 fade(0.01, blue_high, white_low) # 10ms delay
@@ -4,11 +4,47 @@
 #
 # Aaron Reyes
 
+import sys
 import os.path
 import subprocess
+import fcntl
+import struct
+import mmap
+import ctypes
+
+# NumPy is optional, it is only used to blend frames faster
+try:
+  import numpy
+except ImportError:
+  numpy = None
 
 MODULE_NAME = "ws281x"
 
+# layout of the 8 bit pixel formats the module can be loaded with (WS281x_FMT_* in
+# include/WS281x_ioctl.h): bytes per LED and the offsets of the green, red and blue components.
+# the white component of the RGBW formats is left as it is.
+PIXEL_FORMATS = {
+  0: (3, (1, 0, 2)), # RGB
+  1: (3, (0, 1, 2)), # GRB
+  2: (3, (1, 2, 0)), # BGR
+  3: (4, (1, 0, 2)), # RGBW
+  4: (4, (0, 1, 2)), # GRBW
+}
+
+# ioctl commands from include/WS281x_ioctl.h
+WS281x_IOC_COMMIT = 0x7700 # _IO('w', 0)
+WS281x_IOC_SET_BRIGHTNESS = 0x7708 # _IO('w', 8)
+WS281x_IOC_SET_STRIP = 0x4018770A # _IOW('w', 10, struct ws281x_strip)
+WS281x_IOC_GET_STRIP = 0x8018770B # _IOR('w', 11, struct ws281x_strip)
+WS281x_IOC_SET_LAYER = 0x4010770C # _IOW('w', 12, struct ws281x_layer)
+WS281x_IOC_FADE = 0x4018770D # _IOW('w', 13, struct ws281x_fade)
+
+# easing curves of fade()
+EASE_LINEAR = 0
+EASE_IN = 1
+EASE_OUT = 2
+EASE_IN_OUT = 3
+
 
 class Color(object):
   """
@@ -34,7 +70,7 @@ class Color(object):
     self.G = G
 
   def getRed(self):
-    return self.G
+    return self.R
 
   def setRed(self, R):
     self.R = R
@@ -51,6 +87,72 @@ class Color(object):
     self.setBlue(B)
 
 
+def wheel(pos):
+  """
+  Color at a position (0-255) of a color wheel going from red to green to blue and back to red
+  """
+  pos &= 0xFF
+  if pos < 85:
+    return Color(R=(255 - (pos * 3)), G=(pos * 3), B=0)
+  elif pos < 170:
+    pos -= 85
+    return Color(R=0, G=(255 - (pos * 3)), B=(pos * 3))
+  else:
+    pos -= 170
+    return Color(R=(pos * 3), G=0, B=(255 - (pos * 3)))
+
+
+# components of every color on the wheel, used as translate() tables to compute whole frames
+WHEEL_G = bytes(bytearray([wheel(pos).G for pos in range(256)]))
+WHEEL_R = bytes(bytearray([wheel(pos).R for pos in range(256)]))
+WHEEL_B = bytes(bytearray([wheel(pos).B for pos in range(256)]))
+
+
+def scaleTable(factor):
+  """
+  translate() table that scales every byte by factor / 255 (rounded down)
+  """
+  return bytes(bytearray([(k * factor) // 255 for k in range(256)]))
+
+
+
+class PixelColor(Color):
+  """
+  Color of one LED that reads and writes the frame buffer of an LEDs object in place
+  """
+
+  def __init__(self, leds, offset):
+    # no Color.__init__(), the components live in the frame buffer in the module's pixel format
+    self.leds = leds
+    self.g = offset + leds.order[0]
+    self.r = offset + leds.order[1]
+    self.b = offset + leds.order[2]
+
+  @property
+  def G(self):
+    return self.leds.buf[self.g]
+
+  @G.setter
+  def G(self, G):
+    self.leds.buf[self.g] = G
+
+  @property
+  def R(self):
+    return self.leds.buf[self.r]
+
+  @R.setter
+  def R(self, R):
+    self.leds.buf[self.r] = R
+
+  @property
+  def B(self):
+    return self.leds.buf[self.b]
+
+  @B.setter
+  def B(self, B):
+    self.leds.buf[self.b] = B
+
+
 
 class LEDs(object):
   """
@@ -62,47 +164,187 @@ class LEDs(object):
     # check values
     if num_leds <= 0:
       raise ValueError("Invalid number of LEDs: {0}".format(num_leds))
-    if not os.path.isfile(module_path):
-      raise ValueError("Invalid module path: {0}".format(module_path))
     self.num_leds = num_leds
     self.pin_num = pin_num
     self.pin_fun = pin_fun
-    # create internal LED array
-    self.leds = [Color(R=0x00, G=0x00, B=0x00) for led in xrange(num_leds)]
-    # Load the kernel module and open it
-    ret = subprocess.call(["insmod", module_path,
-                           "num_leds={0}".format(num_leds),
-                           "pin_num={0}".format(pin_num),
-                           "pin_fun={0}".format(pin_fun)])
-    # check command status
-    if ret != 0:
-      raise ValueError("Failed to load module")
+    # Load the kernel module once, it keeps the hardware set up between instances
+    if not os.path.isdir("/sys/module/{0}".format(MODULE_NAME)):
+      if not os.path.isfile(module_path):
+        raise ValueError("Invalid module path: {0}".format(module_path))
+      ret = subprocess.call(["insmod", module_path,
+                             "num_leds={0}".format(num_leds),
+                             "pin_num={0}".format(pin_num),
+                             "pin_fun={0}".format(pin_fun)])
+      # check command status
+      if ret != 0:
+        raise ValueError("Failed to load module")
+    # the frame buffer holds pixel data in the format the module was loaded with
+    with open("/sys/module/{0}/parameters/pixel_format".format(MODULE_NAME)) as param:
+      pixel_format = int(param.read())
+    if pixel_format not in PIXEL_FORMATS:
+      raise ValueError("Unsupported pixel format: {0}".format(pixel_format))
+    self.bytes_per_led, self.order = PIXEL_FORMATS[pixel_format]
     # open file for:
     #  - binary writing
     #  - no truncate on opening (appending)
     #  - 0 buffer size (auto-flushing)
     self.module = open("/dev/{0}".format(MODULE_NAME), 'r+b', 0)
+    # lay out the first strip of an already loaded module. it is only changed when it differs,
+    # since that frees stored slots and fails while other clients have layers, and the second
+    # strip is kept as it is
+    strip = struct.unpack("6I", fcntl.ioctl(self.module, WS281x_IOC_GET_STRIP, struct.pack("6I", 0, 0, 0, 0, 0, 0)))
+    if strip[:3] != (num_leds, pin_num, pin_fun):
+      fcntl.ioctl(self.module, WS281x_IOC_SET_STRIP, struct.pack("6I", num_leds, pin_num, pin_fun, *strip[3:]))
+    # one preallocated frame buffer that colors are written into in place
+    self.attach(num_leds * self.bytes_per_led)
+    # views of the frame buffer, created once so setting colors never allocates
+    self.leds = [PixelColor(self, led * self.bytes_per_led) for led in range(num_leds)]
+    # wheel position of every LED for each step rainbow() was called with
+    self.ramps = {}
 
   def __del__(self):
-    # close the file and remove the kernel module
-    self.module.close()
-    subprocess.call(["rmmod", MODULE_NAME])
+    # close the file, the module stays loaded so the next instance starts quickly. nothing may
+    # be open yet if __init__() failed
+    if isinstance(getattr(self, "buf", None), mmap.mmap):
+      self.buf.close()
+    if hasattr(self, "module"):
+      self.module.close()
+
+  def attach(self, size):
+    # the driver's pixel buffer (or the layer of this file) is used as the frame buffer where
+    # mmap() allows writing it in place and render() then only commits it. the mapping keeps
+    # the pixels already in the driver, which other clients may be drawing. python 2 mmap
+    # objects only take strings, so there (or without mmap() support) the frame is a bytearray,
+    # with every LED off, that render() hands to write() without copying.
+    if sys.version_info[0] >= 3:
+      try:
+        self.buf = mmap.mmap(self.module.fileno(), size)
+        self.view = None
+        return
+      except (EnvironmentError, ValueError, TypeError):
+        pass
+    self.buf = bytearray(size)
+    self.view = memoryview(self.buf)
 
   def setColorRGB(self, led, R, G, B):
-    self.leds[led].setRed(R)
-    self.leds[led].setGreen(G)
-    self.leds[led].setBlue(B)
+    offset = led * self.bytes_per_led
+    self.buf[offset + self.order[0]] = G
+    self.buf[offset + self.order[1]] = R
+    self.buf[offset + self.order[2]] = B
 
   def setColor(self, led, color):
-    # set the correct LED
-    self.leds[led] = color
+    # the color is copied into the frame buffer
+    self.setColorRGB(led, color.R, color.G, color.B)
 
   def getColor(self, led):
+    # changing the returned color changes the LED
     return self.leds[led]
 
   def getNumLEDs(self):
     return self.num_leds
 
+  # bulk operations on the whole frame buffer. every one of them is made of slicing and
+  # translate() calls that run once per frame in C, not once per LED in Python.
+
+  def pattern(self, color, count):
+    # count LEDs of one color in the pixel format (with the white component off)
+    pixel = bytearray(self.bytes_per_led)
+    for component, value in zip(self.order, (color.G, color.R, color.B)):
+      pixel[component] = value
+    return bytes(pixel) * count
+
+  def fill(self, color):
+    self.buf[:] = self.pattern(color, self.num_leds)
+
+  def fillRange(self, start, end, color):
+    # LEDs from start up to (not including) end, clipped to the strip
+    start = max(0, min(start, self.num_leds))
+    end = max(start, min(end, self.num_leds))
+    self.buf[start * self.bytes_per_led:end * self.bytes_per_led] = self.pattern(color, end - start)
+
+  def rainbow(self, offset=0, step=1):
+    # LED i gets the color at offset + i * step on the color wheel
+    if step not in self.ramps:
+      self.ramps[step] = bytes(bytearray([(led * step) & 0xFF for led in range(self.num_leds)]))
+    offset &= 0xFF
+    # the wheel tables are rotated by the offset so no position has to be computed per LED
+    for component, table in zip(self.order, (WHEEL_G, WHEEL_R, WHEEL_B)):
+      self.buf[component::self.bytes_per_led] = self.ramps[step].translate(table[offset:] + table[:offset])
+
+  def scale(self, factor):
+    # scales every color by factor / 255 (fades the frame buffer, unlike setBrightness())
+    self.buf[:] = self.buf[:].translate(scaleTable(factor))
+
+  def rotate(self, count):
+    # moves every LED count places up the strip, the LEDs at the end wrap around to the start
+    split = (count % self.num_leds) * self.bytes_per_led
+    if split:
+      self.buf[:] = self.buf[-split:] + self.buf[:-split]
+
+  def shift(self, count, color=Color(R=0x00, G=0x00, B=0x00)):
+    # moves every LED count places up (or down for a negative count) the strip, the LEDs that
+    # are uncovered get color
+    moved = min(abs(count), self.num_leds)
+    split = moved * self.bytes_per_led
+    if count > 0:
+      self.buf[:] = self.pattern(color, moved) + self.buf[:len(self.buf) - split]
+    elif count < 0:
+      self.buf[:] = self.buf[split:] + self.pattern(color, moved)
+
+  def getFrame(self):
+    # copy of the frame buffer, for setFrame() and blend()
+    return bytes(self.buf[:])
+
+  def setFrame(self, frame):
+    if len(frame) != len(self.buf):
+      raise ValueError("Invalid frame length: {0}".format(len(frame)))
+    self.buf[:] = frame
+
+  def blend(self, frame1, frame2, alpha):
+    # frame1 faded into frame2 by alpha (0 is frame1, 255 is frame2)
+    if len(frame1) != len(self.buf) or len(frame2) != len(self.buf):
+      raise ValueError("Invalid frame length: {0}/{1}".format(len(frame1), len(frame2)))
+    if numpy is not None:
+      frame1 = numpy.frombuffer(frame1, dtype=numpy.uint8).astype(numpy.uint16)
+      frame2 = numpy.frombuffer(frame2, dtype=numpy.uint8).astype(numpy.uint16)
+      self.buf[:] = (((frame1 * (255 - alpha)) + (frame2 * alpha)) // 255).astype(numpy.uint8).tobytes()
+      return
+    frame1 = bytes(frame1).translate(scaleTable(255 - alpha))
+    frame2 = bytes(frame2).translate(scaleTable(alpha))
+    if hasattr(int, "from_bytes"):
+      # the scaled bytes never add up to more than 255, so one big integer addition adds them all
+      total = int.from_bytes(frame1, "big") + int.from_bytes(frame2, "big")
+      self.buf[:] = total.to_bytes(len(self.buf), "big")
+    else:
+      self.buf[:] = bytearray([x + y for x, y in zip(bytearray(frame1), bytearray(frame2))])
+
   def render(self):
-    self.module.write("".join([led.serialize() for led in self.leds]))
+    if self.view is None:
+      # the frame is already in the driver's buffer
+      fcntl.ioctl(self.module, WS281x_IOC_COMMIT)
+    else:
+      self.module.write(self.view)
+
+  def setBrightness(self, brightness):
+    # dims the whole strip (0-255) in the kernel, the last frame is rendered again without writing it
+    fcntl.ioctl(self.module, WS281x_IOC_SET_BRIGHTNESS, brightness)
+
+  def fade(self, duration_ms, easing=EASE_LINEAR, frame_us=0):
+    # fades the LEDs from what they show to the frame buffer over duration_ms. the driver renders
+    # the frames in between on its own, so this returns right away and the next render() ends it
+    data = 0
+    if self.view is not None:
+      data = ctypes.addressof((ctypes.c_char * len(self.buf)).from_buffer(self.buf))
+    fcntl.ioctl(self.module, WS281x_IOC_FADE, struct.pack("4IQ", duration_ms, frame_us, easing, 0, data))
+
+  def setLayer(self, start, num_leds, priority=0, alpha=255):
+    # draws into a layer over num_leds LEDs from start, blended over what other processes write to
+    # the strip. render() then fills the layer from the first LEDs (0 LEDs removes the layer)
+    fcntl.ioctl(self.module, WS281x_IOC_SET_LAYER, struct.pack("4I", start, num_leds, priority, alpha))
+    # a mapping follows the file over to its layer (or back to the pixel buffer), which starts
+    # out with the pixels below it
+    if self.view is None:
+      size = len(self.buf)
+      self.buf.close()
+      self.attach(size)
 
@@ -0,0 +1,348 @@
+/*
+ * encoder.c
+ *
+ * Table driven encoder that converts pixel data into the serial PWM bit stream.
+ * This file has no kernel dependencies so it can also be built in userspace.
+ *
+ * Aaron Reyes
+ */
+
+#include <encoder.h>       /* for interface definition */
+#include <WS281x_ioctl.h>  /* for WS281x_FMT_* */
+
+/* component order and bytes per component of every pixel format */
+static const struct {
+  const char *order;
+  unsigned int width;
+} encoder_formats[] = {
+  [WS281x_FMT_RGB] = { "RGB", 1 },
+  [WS281x_FMT_GRB] = { "GRB", 1 },
+  [WS281x_FMT_BGR] = { "BGR", 1 },
+  [WS281x_FMT_RGBW] = { "RGBW", 1 },
+  [WS281x_FMT_GRBW] = { "GRBW", 1 },
+  [WS281x_FMT_RGB16] = { "RGB", 2 },
+  [WS281x_FMT_RGBW16] = { "RGBW", 2 },
+};
+
+#define ENCODER_NUM_FORMATS (sizeof(encoder_formats) / sizeof(encoder_formats[0]))
+
+/* encoded symbols (32 bits with 4 bit symbols, 24 bits with 3 bit symbols) for every possible byte value */
+static uint32_t encoder_symbols[256];
+
+/* encoded symbols for every possible input byte of each wire component (lookup table applied) */
+static uint32_t encoder_table[ENCODER_MAX_COMPONENTS][256];
+
+/* lookup table applied to each input component (identity until one is set) */
+static uint8_t encoder_lut[ENCODER_MAX_COMPONENTS][256];
+static int encoder_lut_set;
+
+/* current format: bytes per input pixel, words per pixel on the wire, the input byte and
+ * input component (-1 if the input has none) of each wire component */
+static unsigned int encoder_in_len = 3;
+static unsigned int encoder_out_len = 3;
+static unsigned int encoder_map[ENCODER_MAX_COMPONENTS] = { 0, 1, 2, 3 };
+static int encoder_comp[ENCODER_MAX_COMPONENTS] = { 0, 1, 2, 3 };
+
+/* non-zero if the input bytes are already in wire order */
+static int encoder_direct = 1;
+
+/* symbol used for a 1 bit and the number of PWM slots per symbol */
+static uint32_t encoder_one;
+static unsigned int encoder_bits = 4;
+
+
+/*
+ * folds the pixel format and the lookup table into the per wire component encode tables
+ */
+static void encoder_build(void) {
+  uint32_t j, i;
+  int c;
+  for (j = 0; j < encoder_out_len; j++) {
+    c = encoder_comp[j];
+    for (i = 0; i < 256; i++) {
+      // components missing from the input (white) are always sent as 0
+      if (c < 0) {
+        encoder_table[j][i] = encoder_symbols[0];
+      } else {
+        encoder_table[j][i] = encoder_symbols[encoder_lut_set ? encoder_lut[c][i] : i];
+      }
+    }
+  }
+}
+
+
+void encoder_init(uint32_t one, uint32_t zero, unsigned int bits) {
+  uint32_t i, bit, word, mask = (1 << bits) - 1;
+  encoder_bits = bits;
+  encoder_one = one & mask;
+  for (i = 0; i < 256; i++) {
+    // the PWM shifts out the MSB of each word first so bit 7 lands in the top symbol
+    word = 0;
+    for (bit = 0; bit < 8; bit++) {
+      word |= ((i & (1 << bit)) ? (one & mask) : (zero & mask)) << (bit * bits);
+    }
+    encoder_symbols[i] = word;
+  }
+  encoder_build();
+}
+
+
+unsigned int encoder_format_len(unsigned int fmt) {
+  unsigned int len = 0;
+  if (fmt < ENCODER_NUM_FORMATS && encoder_formats[fmt].order) {
+    while (encoder_formats[fmt].order[len]) {
+      len++;
+    }
+    len *= encoder_formats[fmt].width;
+  }
+  return len;
+}
+
+
+int encoder_set_format(unsigned int pixel_fmt, unsigned int wire_fmt) {
+  const char *in, *out;
+  unsigned int width, j, c;
+  if (!encoder_format_len(pixel_fmt) || !encoder_format_len(wire_fmt) || encoder_formats[wire_fmt].width != 1) {
+    return -1;
+  }
+  in = encoder_formats[pixel_fmt].order;
+  out = encoder_formats[wire_fmt].order;
+  width = encoder_formats[pixel_fmt].width;
+  encoder_in_len = encoder_format_len(pixel_fmt);
+  encoder_out_len = encoder_format_len(wire_fmt);
+  encoder_direct = (width == 1 && encoder_in_len == encoder_out_len);
+  for (j = 0; j < encoder_out_len; j++) {
+    // find the wire component in the input pixel
+    for (c = 0; in[c] && in[c] != out[j]; c++);
+    if (!in[c]) {
+      // any byte will do since the table of a missing component is constant
+      encoder_comp[j] = -1;
+      encoder_map[j] = 0;
+    } else {
+      encoder_comp[j] = c;
+      // 16 bit components are reduced to their most significant byte (native byte order)
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+      encoder_map[j] = (c * width) + (width - 1);
+#else
+      encoder_map[j] = c * width;
+#endif
+    }
+    encoder_direct = encoder_direct && (encoder_map[j] == j);
+  }
+  encoder_build();
+  return 0;
+}
+
+
+unsigned int encoder_pixel_len(void) {
+  return encoder_in_len;
+}
+
+
+unsigned int encoder_wire_len(void) {
+  return encoder_out_len;
+}
+
+
+size_t encoder_words(size_t pixels) {
+  // 8 symbols per color component
+  return ((pixels * encoder_out_len * 8 * encoder_bits) + 31) / 32;
+}
+
+
+size_t encoder_pixels(size_t words) {
+  return (words * 32) / (encoder_out_len * 8 * encoder_bits);
+}
+
+
+unsigned int encoder_group_len(void) {
+  unsigned int bits = encoder_out_len * 8 * encoder_bits, group = 1;
+  // smallest number of pixels that fills a whole number of words
+  while ((group * bits) % 32) {
+    group++;
+  }
+  return group;
+}
+
+
+void encoder_set_lut(const uint8_t lut[ENCODER_MAX_COMPONENTS][256]) {
+  uint32_t c, i;
+  encoder_lut_set = (lut != NULL);
+  if (lut) {
+    for (c = 0; c < ENCODER_MAX_COMPONENTS; c++) {
+      for (i = 0; i < 256; i++) {
+        encoder_lut[c][i] = lut[c][i];
+      }
+    }
+  }
+  encoder_build();
+}
+
+
+/*
+ * encodes pixel data that is already in wire order with one 32 bit store per input byte
+ */
+static void encoder_run_direct(uint32_t *dst, const uint8_t *src, size_t len) {
+  const uint32_t *t0 = encoder_table[0], *t1 = encoder_table[1], *t2 = encoder_table[2], *t3 = encoder_table[3];
+  unsigned int j = 0;
+  // bulk path for long runs of pixel data (ENCODER_BULK_LEN is a whole number of pixels)
+  if (encoder_out_len == 3) {
+    while (len >= ENCODER_BULK_LEN) {
+      dst[0] = t0[src[0]];
+      dst[1] = t1[src[1]];
+      dst[2] = t2[src[2]];
+      dst[3] = t0[src[3]];
+      dst[4] = t1[src[4]];
+      dst[5] = t2[src[5]];
+      dst[6] = t0[src[6]];
+      dst[7] = t1[src[7]];
+      dst[8] = t2[src[8]];
+      dst[9] = t0[src[9]];
+      dst[10] = t1[src[10]];
+      dst[11] = t2[src[11]];
+      dst += ENCODER_BULK_LEN;
+      src += ENCODER_BULK_LEN;
+      len -= ENCODER_BULK_LEN;
+    }
+  } else {
+    while (len >= ENCODER_BULK_LEN) {
+      dst[0] = t0[src[0]];
+      dst[1] = t1[src[1]];
+      dst[2] = t2[src[2]];
+      dst[3] = t3[src[3]];
+      dst[4] = t0[src[4]];
+      dst[5] = t1[src[5]];
+      dst[6] = t2[src[6]];
+      dst[7] = t3[src[7]];
+      dst[8] = t0[src[8]];
+      dst[9] = t1[src[9]];
+      dst[10] = t2[src[10]];
+      dst[11] = t3[src[11]];
+      dst += ENCODER_BULK_LEN;
+      src += ENCODER_BULK_LEN;
+      len -= ENCODER_BULK_LEN;
+    }
+  }
+  // remaining bytes
+  while (len--) {
+    *dst++ = encoder_table[j][*src++];
+    j = (j + 1) % encoder_out_len;
+  }
+}
+
+
+/*
+ * packs 4 24 bit symbols (3 bit symbols for 8 bits) into 3 words
+ */
+static inline void encoder_pack(uint32_t *dst, size_t stride, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  dst[0] = (a << 8) | (b >> 16);
+  dst[stride] = (b << 16) | (c >> 8);
+  dst[2 * stride] = (c << 24) | d;
+}
+
+
+/*
+ * encodes pixels with 3 bit symbols, packing the 24 bit symbols of the color components across
+ * word boundaries
+ */
+static void encoder_run_packed(uint32_t *dst, const uint8_t *src, size_t pixels, size_t stride) {
+  const uint32_t *t0 = encoder_table[0], *t1 = encoder_table[1], *t2 = encoder_table[2], *t3 = encoder_table[3];
+  const unsigned int m0 = encoder_map[0], m1 = encoder_map[1], m2 = encoder_map[2], m3 = encoder_map[3];
+  const unsigned int in_len = encoder_in_len;
+  uint64_t acc = 0;
+  unsigned int n = 0, j;
+  if (encoder_out_len == 3) {
+    // 4 pixels (12 components) fill 9 words
+    while (pixels >= 4) {
+      encoder_pack(dst, stride, t0[src[m0]], t1[src[m1]], t2[src[m2]], t0[src[in_len + m0]]);
+      encoder_pack(dst + (3 * stride), stride, t1[src[in_len + m1]], t2[src[in_len + m2]], t0[src[(2 * in_len) + m0]], t1[src[(2 * in_len) + m1]]);
+      encoder_pack(dst + (6 * stride), stride, t2[src[(2 * in_len) + m2]], t0[src[(3 * in_len) + m0]], t1[src[(3 * in_len) + m1]], t2[src[(3 * in_len) + m2]]);
+      dst += 9 * stride;
+      src += 4 * in_len;
+      pixels -= 4;
+    }
+  } else {
+    // every pixel fills 3 words
+    while (pixels) {
+      encoder_pack(dst, stride, t0[src[m0]], t1[src[m1]], t2[src[m2]], t3[src[m3]]);
+      dst += 3 * stride;
+      src += in_len;
+      pixels--;
+    }
+  }
+  // remaining pixels
+  while (pixels--) {
+    for (j = 0; j < encoder_out_len; j++) {
+      acc = (acc << 24) | encoder_table[j][src[encoder_map[j]]];
+      n += 24;
+      if (n >= 32) {
+        n -= 32;
+        *dst = (uint32_t)(acc >> n);
+        dst += stride;
+      }
+    }
+    src += in_len;
+  }
+  // the rest of the last word is sent low, like the start of the RESET signal
+  if (n) {
+    *dst = (uint32_t)(acc << (32 - n));
+  }
+}
+
+
+void encoder_run(uint32_t *dst, const uint8_t *src, size_t pixels, size_t stride) {
+  const uint32_t *t0 = encoder_table[0], *t1 = encoder_table[1], *t2 = encoder_table[2], *t3 = encoder_table[3];
+  const unsigned int m0 = encoder_map[0], m1 = encoder_map[1], m2 = encoder_map[2], m3 = encoder_map[3];
+  const unsigned int in_len = encoder_in_len;
+  if (encoder_bits == 3) {
+    encoder_run_packed(dst, src, pixels, stride);
+    return;
+  }
+  if (encoder_direct && stride == 1) {
+    encoder_run_direct(dst, src, pixels * encoder_out_len);
+    return;
+  }
+  // reorder, reduce and encode one pixel at a time
+  if (encoder_out_len == 3) {
+    while (pixels--) {
+      dst[0] = t0[src[m0]];
+      dst[stride] = t1[src[m1]];
+      dst[2 * stride] = t2[src[m2]];
+      dst += 3 * stride;
+      src += in_len;
+    }
+  } else {
+    while (pixels--) {
+      dst[0] = t0[src[m0]];
+      dst[stride] = t1[src[m1]];
+      dst[2 * stride] = t2[src[m2]];
+      dst[3 * stride] = t3[src[m3]];
+      dst += 4 * stride;
+      src += in_len;
+    }
+  }
+}
+
+
+void encoder_decode(uint8_t *dst, const uint32_t *src, size_t len, size_t stride) {
+  uint32_t bit, slot, sym;
+  unsigned int pos = 0;
+  while (len--) {
+    *dst = 0;
+    for (bit = 8; bit-- > 0;) {
+      // symbols are read MSB first and may straddle two words
+      sym = 0;
+      for (slot = 0; slot < encoder_bits; slot++) {
+        sym = (sym << 1) | ((*src >> (31 - pos)) & 1);
+        if (++pos == 32) {
+          pos = 0;
+          src += stride;
+        }
+      }
+      if (sym == encoder_one) {
+        *dst |= (1 << bit);
+      }
+    }
+    dst++;
+  }
+}
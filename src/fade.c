@@ -0,0 +1,113 @@
+/*
+ * fade.c
+ *
+ * Timer that steps crossfades between frames and the easing curves applied to them
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h>    /* for printk KERN_INFO */
+#include <linux/hrtimer.h>   /* for the step timer */
+#include <linux/ktime.h>     /* for ktime_get() */
+#include <linux/math64.h>    /* for div64_u64() */
+#include <linux/workqueue.h> /* for rendering outside of interrupt context */
+#include <asm/errno.h>       /* for linux error return codes */
+
+#include <fade.h>            /* for interface definition */
+#include <frame.h>           /* for frame_fade_tick() */
+#include <WS281x.h>          /* for DRIVER_NAME */
+#include <WS281x_ioctl.h>    /* for WS281x_EASE_* */
+
+/* timing of the current fade */
+static ktime_t fade_begin;
+static u64 fade_duration_ns;
+static u64 fade_frame_ns;
+static unsigned int fade_easing;
+
+/* timer for the next intermediate frame and the work it queues to render it */
+static struct hrtimer fade_timer;
+static struct workqueue_struct *fade_wq;
+static struct work_struct fade_work;
+
+
+/*
+ * renders the next intermediate frame (runs on the fade workqueue) and schedules the one after
+ * it. frames that are due while rendering are skipped, the next one always starts on a
+ * multiple of the frame time since the start of the fade.
+ */
+static void fade_work_fn(struct work_struct *work) {
+  u64 elapsed;
+  if (!frame_fade_tick()) {
+    return;
+  }
+  if (!fade_frame_ns) {
+    queue_work(fade_wq, &fade_work);
+    return;
+  }
+  elapsed = ktime_to_ns(ktime_sub(ktime_get(), fade_begin));
+  elapsed = (div64_u64(elapsed, fade_frame_ns) + 1) * fade_frame_ns;
+  hrtimer_start(&fade_timer, ktime_add_ns(fade_begin, elapsed), HRTIMER_MODE_ABS);
+}
+
+
+/*
+ * step timer callback. rendering sleeps so it is deferred to the workqueue.
+ */
+static enum hrtimer_restart fade_timer_fn(struct hrtimer *timer) {
+  queue_work(fade_wq, &fade_work);
+  return HRTIMER_NORESTART;
+}
+
+
+int fade_init(void) {
+  fade_wq = alloc_workqueue("%s_fade", WQ_HIGHPRI, 1, DRIVER_NAME);
+  if (!fade_wq) {
+    printk(KERN_ALERT "%s: (fade_init) alloc_workqueue error\n", DRIVER_NAME);
+    return -ENOMEM;
+  }
+  INIT_WORK(&fade_work, fade_work_fn);
+  hrtimer_init(&fade_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  fade_timer.function = fade_timer_fn;
+  return 0;
+}
+
+
+void fade_start(unsigned int duration_ms, unsigned int frame_us, unsigned int easing) {
+  fade_begin = ktime_get();
+  fade_duration_ns = (u64)duration_ms * NSEC_PER_MSEC;
+  fade_frame_ns = (u64)frame_us * NSEC_PER_USEC;
+  fade_easing = easing;
+  // a frame that was scheduled for the previous fade is rendered right away instead
+  hrtimer_try_to_cancel(&fade_timer);
+  queue_work(fade_wq, &fade_work);
+}
+
+
+unsigned int fade_progress(void) {
+  u64 elapsed = ktime_to_ns(ktime_sub(ktime_get(), fade_begin)), t, u;
+  if (elapsed >= fade_duration_ns) {
+    return FADE_ONE;
+  }
+  t = div64_u64(elapsed << FADE_SHIFT, fade_duration_ns);
+  switch (fade_easing) {
+    case WS281x_EASE_IN:
+      return (t * t) >> FADE_SHIFT;
+    case WS281x_EASE_OUT:
+      u = FADE_ONE - t;
+      return FADE_ONE - ((u * u) >> FADE_SHIFT);
+    case WS281x_EASE_IN_OUT:
+      // smoothstep 3t^2 - 2t^3, rounded once at the end so it never steps backwards
+      return ((t * t) * ((3 * FADE_ONE) - (2 * t))) >> (2 * FADE_SHIFT);
+    default:
+      return t;
+  }
+}
+
+
+void fade_cleanup(void) {
+  // the work only arms the timer while a fade is running, so cancelling both in turn is enough
+  hrtimer_cancel(&fade_timer);
+  cancel_work_sync(&fade_work);
+  hrtimer_cancel(&fade_timer);
+  destroy_workqueue(fade_wq);
+}
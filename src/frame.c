@@ -0,0 +1,1086 @@
+/*
+ * frame.c
+ *
+ * Kernel side pixel buffer that can be written to or mmap()ed by userspace
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h>  /* for printk KERN_INFO */
+#include <linux/mutex.h>   /* for the frame lock */
+#include <linux/list.h>    /* for the list of layers */
+#include <linux/slab.h>    /* for kzalloc() */
+#include <linux/vmalloc.h> /* for vmalloc_user() */
+#include <linux/mm.h>      /* for remap_vmalloc_range() and PAGE_ALIGN */
+#include <linux/uaccess.h> /* for copy_from_user() */
+#include <linux/uio.h>     /* for copy_from_iter() */
+#include <linux/poll.h>    /* for poll_wait() */
+#include <linux/string.h>  /* for memcpy() */
+#include <asm/errno.h>     /* for linux error return codes */
+
+#include <frame.h>         /* for interface definition */
+#include <pacer.h>         /* for the paced frame ring */
+#include <fade.h>          /* for the crossfade timer */
+#include <hal.h>           /* for hardware interface functions */
+#include <encoder.h>       /* for the pixel format */
+#include <WS281x.h>        /* for WS281x macros and user parameters */
+
+/* page aligned pixel buffer shared with userspace and its length */
+static char *frame_buf;
+static size_t frame_len;
+
+/* copy of the last frame handed to the hardware, used to find the pixels that changed */
+static char *frame_out;
+
+/* pixel range drawn by one open file over the pixel buffer */
+struct frame_layer {
+  struct list_head node; /* entry in frame_layers while the layer is set */
+  char *buf;             /* pixel data of the layer (NULL while the file draws into frame_buf) */
+  size_t off;            /* byte offset of the layer into the frame */
+  size_t len;            /* length in bytes of the layer */
+  unsigned int priority;
+  unsigned int alpha;
+};
+
+/* layers drawn over the pixel buffer (lowest priority first) and their number */
+static LIST_HEAD(frame_layers);
+static unsigned int frame_num_layers;
+
+/* pixel buffer with the layers drawn on it, only used while there are layers */
+static char *frame_comp;
+
+/* lookup table set by userspace (identity by default), the global brightness applied on top
+ * of it and the resulting table handed to the hardware */
+static uint8_t frame_lut[ENCODER_MAX_COMPONENTS][256];
+static unsigned int frame_brightness;
+static uint8_t frame_lut_out[ENCODER_MAX_COMPONENTS][256];
+
+/* pixel data of the frames stored in slots and of the animation that may be playing, kept so
+ * a fade can start from whatever the LEDs show */
+static char *frame_slots[WS281x_MAX_SLOTS];
+static char *frame_anim;
+
+/* pixel data on the LEDs while it is not frame_out (a slot that is shown or the frame an
+ * animation stopped on), only valid while frame_shown_set is non-zero */
+static char *frame_shown;
+static int frame_shown_set;
+
+/* crossfade that is running: the frame it started from, the frame it ends on and the
+ * intermediate frame back to back (NULL while no fade is running) */
+static char *frame_fade_buf;
+
+/* zero once a strip layout failed and the previous one could not be restored either */
+static int frame_has_strip;
+
+/* serializes access to the frame buffers, the pacer ring and the hardware */
+static DEFINE_MUTEX(frame_lock);
+
+
+/*
+ * copies every run of bytes that differs between new pixel data and the last rendered frame
+ * and marks only those runs as changed. this keeps both the re-encode and the transmitted
+ * length as short as possible.
+ *
+ * src - complete frame of new pixel data
+ * off - byte offset into the frame to start comparing at
+ * len - number of bytes to compare
+ */
+static void frame_sync(const char *src, size_t off, size_t len) {
+  size_t i = off, end = off + len, start;
+  while (i < end) {
+    // skip bytes that did not change
+    while (i < end && src[i] == frame_out[i]) {
+      i++;
+    }
+    start = i;
+    while (i < end && src[i] != frame_out[i]) {
+      i++;
+    }
+    if (i > start) {
+      memcpy(frame_out + start, src + start, i - start);
+      hal_invalidate(start, i - start);
+    }
+  }
+}
+
+
+/*
+ * draws pixel data of a layer over a range of the composited frame
+ *
+ * dst - composited pixels
+ * src - pixel data of the layer
+ * len - length in bytes (whole pixels)
+ * alpha - opacity of src (0 to WS281x_ALPHA_OPAQUE)
+ */
+static void frame_blend(char *dst, const char *src, size_t len, unsigned int alpha) {
+  size_t i;
+  uint16_t *dst16 = (uint16_t *)dst;
+  const uint16_t *src16 = (const uint16_t *)src;
+  uint8_t *dst8 = (uint8_t *)dst;
+  const uint8_t *src8 = (const uint8_t *)src;
+  if (alpha == WS281x_ALPHA_OPAQUE) {
+    memcpy(dst, src, len);
+    return;
+  }
+  // 16 bit components are blended as a whole, any other format a byte at a time
+  if (pixel_format == WS281x_FMT_RGB16 || pixel_format == WS281x_FMT_RGBW16) {
+    for (i = 0; i < len / sizeof(uint16_t); i++) {
+      dst16[i] = ((src16[i] * alpha) + (dst16[i] * (WS281x_ALPHA_OPAQUE - alpha)) + (WS281x_ALPHA_OPAQUE / 2)) / WS281x_ALPHA_OPAQUE;
+    }
+  } else {
+    for (i = 0; i < len; i++) {
+      dst8[i] = ((src8[i] * alpha) + (dst8[i] * (WS281x_ALPHA_OPAQUE - alpha)) + (WS281x_ALPHA_OPAQUE / 2)) / WS281x_ALPHA_OPAQUE;
+    }
+  }
+}
+
+
+/*
+ * draws the layers over a range of the pixel buffer. returns the complete frame to render,
+ * which is the pixel buffer itself while there are no layers. must be called with frame_lock
+ * held.
+ *
+ * off - byte offset of the range that changed
+ * len - length of the range that changed
+ */
+static const char *frame_compose(size_t off, size_t len) {
+  struct frame_layer *layer;
+  size_t pixel_len = encoder_pixel_len(), end = off + len, lo, hi;
+  if (list_empty(&frame_layers)) {
+    return frame_buf;
+  }
+  // layers are blended a whole pixel at a time
+  off = rounddown(off, pixel_len);
+  end = roundup(end, pixel_len);
+  memcpy(frame_comp + off, frame_buf + off, end - off);
+  list_for_each_entry(layer, &frame_layers, node) {
+    lo = max(off, layer->off);
+    hi = min(end, layer->off + layer->len);
+    if (hi > lo) {
+      frame_blend(frame_comp + lo, layer->buf + (lo - layer->off), hi - lo, layer->alpha);
+    }
+  }
+  return frame_comp;
+}
+
+
+/*
+ * interpolates between two frames
+ *
+ * dst - interpolated pixels
+ * from - pixels at the start of the fade
+ * to - pixels at the end of the fade
+ * len - length in bytes (whole pixels)
+ * progress - how far between from and to (0 to FADE_ONE)
+ */
+static void frame_lerp(char *dst, const char *from, const char *to, size_t len, unsigned int progress) {
+  size_t i;
+  uint16_t *dst16 = (uint16_t *)dst;
+  const uint16_t *from16 = (const uint16_t *)from, *to16 = (const uint16_t *)to;
+  uint8_t *dst8 = (uint8_t *)dst;
+  const uint8_t *from8 = (const uint8_t *)from, *to8 = (const uint8_t *)to;
+  // 16 bit components are interpolated as a whole, any other format a byte at a time. the
+  // weighted sum of two 16 bit values still fits in 32 bits.
+  if (pixel_format == WS281x_FMT_RGB16 || pixel_format == WS281x_FMT_RGBW16) {
+    for (i = 0; i < len / sizeof(uint16_t); i++) {
+      dst16[i] = ((from16[i] * (FADE_ONE - progress)) + (to16[i] * progress)) >> FADE_SHIFT;
+    }
+  } else {
+    for (i = 0; i < len; i++) {
+      dst8[i] = ((from8[i] * (FADE_ONE - progress)) + (to8[i] * progress)) >> FADE_SHIFT;
+    }
+  }
+}
+
+
+/*
+ * ends the fade that is running (if any) at once. the frame it was fading to becomes the last
+ * frame handed to the hardware, so the next frame that is rendered sends every pixel that is
+ * still on an intermediate color. must be called with frame_lock held.
+ */
+static void frame_fade_cancel(void) {
+  if (frame_fade_buf) {
+    frame_sync(frame_fade_buf + frame_len, 0, frame_len);
+    vfree(frame_fade_buf);
+    frame_fade_buf = NULL;
+  }
+}
+
+
+/*
+ * hands frame_out to the hardware, which replaces a slot or animation on the LEDs. must be
+ * called with frame_lock held. returns 0 on success or a negative error code.
+ */
+static int frame_render(void) {
+  frame_shown_set = 0;
+  vfree(frame_anim);
+  frame_anim = NULL;
+  return hal_render(frame_out, frame_len);
+}
+
+
+/*
+ * stops the animation that is playing (if any). the LEDs keep the frame being shown, which is
+ * remembered in frame_shown. must be called with frame_lock held.
+ */
+static void frame_stop_anim(void) {
+  int idx = hal_anim_frame();
+  if (idx >= 0) {
+    memcpy(frame_shown, frame_anim + (idx * frame_len), frame_len);
+    frame_shown_set = 1;
+  }
+  hal_stop();
+  vfree(frame_anim);
+  frame_anim = NULL;
+}
+
+
+/*
+ * frees the pixel data kept for slots and animations (the hardware frees its copies when the
+ * strip is laid out again). must be called with frame_lock held.
+ */
+static void frame_free_shown(void) {
+  int i;
+  for (i = 0; i < WS281x_MAX_SLOTS; i++) {
+    vfree(frame_slots[i]);
+    frame_slots[i] = NULL;
+  }
+  vfree(frame_anim);
+  frame_anim = NULL;
+  frame_shown_set = 0;
+}
+
+
+/*
+ * returns the buffer that a file draws into and the range of the frame it covers (its layer or
+ * the whole pixel buffer). must be called with frame_lock held.
+ *
+ * layer - layer of the file
+ * off - set to the byte offset of the range into the frame
+ * len - set to the length of the range
+ */
+static char *frame_target(const struct frame_layer *layer, size_t *off, size_t *len) {
+  if (layer->buf) {
+    *off = layer->off;
+    *len = layer->len;
+    return layer->buf;
+  }
+  *off = 0;
+  *len = frame_len;
+  return frame_buf;
+}
+
+
+/*
+ * hands a range of the frame that userspace changed to the hardware. when pacing is
+ * enabled a snapshot of the composited frame is queued for the refresh timer instead. must be
+ * called with frame_lock held. returns 0 on success or a negative error code.
+ *
+ * off - byte offset of the changed range
+ * len - length of the changed range
+ */
+static int frame_submit(size_t off, size_t len) {
+  const char *src;
+  frame_fade_cancel();
+  src = frame_compose(off, len);
+  if (pacer_enabled()) {
+    return pacer_push(src);
+  }
+  frame_sync(src, off, len);
+  return frame_render();
+}
+
+
+/*
+ * returns non-zero if a frame can be submitted without sleeping, either into the pacer ring or
+ * straight to the hardware
+ */
+static int frame_ready(void) {
+  return pacer_enabled() ? pacer_room() : hal_ready();
+}
+
+
+/*
+ * takes frame_lock once another frame can be submitted without blocking inside the lock. a
+ * non-blocking caller gets -EAGAIN instead of sleeping for the lock, the pacer ring or the
+ * previous transfer. returns 0 on success, -EAGAIN or -ERESTARTSYS if interrupted.
+ *
+ * nonblock - non-zero to fail instead of sleeping
+ */
+static int frame_lock_room(int nonblock) {
+  int err;
+  for (;;) {
+    if (nonblock) {
+      if (!mutex_trylock(&frame_lock)) {
+        return -EAGAIN;
+      }
+    } else if (mutex_lock_interruptible(&frame_lock)) {
+      return -ERESTARTSYS;
+    }
+    if (nonblock ? frame_ready() : pacer_room()) {
+      return 0;
+    }
+    mutex_unlock(&frame_lock);
+    if (nonblock) {
+      return -EAGAIN;
+    }
+    err = pacer_wait_room();
+    if (err) {
+      return err;
+    }
+  }
+}
+
+
+/*
+ * combines the lookup table with the global brightness and renders the last frame again with
+ * it. must be called with frame_lock held. returns 0 on success or a negative error code.
+ */
+static int frame_apply_lut(void) {
+  int c, i;
+  for (c = 0; c < ENCODER_MAX_COMPONENTS; c++) {
+    for (i = 0; i < 256; i++) {
+      frame_lut_out[c][i] = ((frame_lut[c][i] * frame_brightness) + (WS281x_BRIGHTNESS_MAX / 2)) / WS281x_BRIGHTNESS_MAX;
+    }
+  }
+  hal_set_lut((const uint8_t (*)[256])frame_lut_out);
+  // nothing is needed from userspace, the retained frame is encoded again with the new table
+  return frame_render();
+}
+
+
+/*
+ * reads the strip layout and pixel format currently in use
+ */
+static void frame_get_params(struct ws281x_strip *strip, struct ws281x_format *fmt) {
+  strip->num_leds = num_leds;
+  strip->pin_num = pin_num;
+  strip->pin_fun = pin_fun;
+  strip->num_leds2 = num_leds2;
+  strip->pin_num2 = pin_num2;
+  strip->pin_fun2 = pin_fun2;
+  fmt->pixel_format = pixel_format;
+  fmt->wire_format = wire_format;
+}
+
+
+/*
+ * makes a strip layout and pixel format the current one (also shown by the module parameters).
+ * returns 0 on success or -EINVAL for an invalid pixel format, leaving everything as it was.
+ */
+static int frame_set_params(const struct ws281x_strip *strip, const struct ws281x_format *fmt) {
+  if (encoder_set_format(fmt->pixel_format, fmt->wire_format)) {
+    return -EINVAL;
+  }
+  num_leds = strip->num_leds;
+  pin_num = strip->pin_num;
+  pin_fun = strip->pin_fun;
+  num_leds2 = strip->num_leds2;
+  pin_num2 = strip->pin_num2;
+  pin_fun2 = strip->pin_fun2;
+  pixel_format = fmt->pixel_format;
+  wire_format = fmt->wire_format;
+  return 0;
+}
+
+
+/*
+ * switches the driver over to a new strip layout and pixel format, reallocating the pixel
+ * buffer, the pacer ring and the hardware buffers. on failure the previous layout is laid
+ * out again, if that fails too the hardware has no strip until a later call succeeds.
+ * the new pixel buffer starts out black but the LEDs keep their colors until the next frame,
+ * which is sent whole. must be called with frame_lock held and the pacer stopped. returns 0
+ * on success or a negative error code.
+ *
+ * strip - new number of LEDs and output pins
+ * fmt - new pixel format
+ */
+static int frame_reconfigure(const struct ws281x_strip *strip, const struct ws281x_format *fmt) {
+  struct ws281x_strip old_strip;
+  struct ws281x_format old_fmt;
+  char *buf, *out, *comp, *shown;
+  size_t len;
+  int err;
+  if (!strip->num_leds || strip->num_leds > WS281x_MAX_LEDS || strip->num_leds2 > WS281x_MAX_LEDS) {
+    return -EINVAL;
+  }
+  len = (strip->num_leds + strip->num_leds2) * encoder_format_len(fmt->pixel_format);
+  if (!len) {
+    return -EINVAL;
+  }
+  frame_get_params(&old_strip, &old_fmt);
+  // nothing to do if the layout does not change, so reopening the device stays cheap
+  if (frame_has_strip && !memcmp(strip, &old_strip, sizeof(old_strip)) && !memcmp(fmt, &old_fmt, sizeof(old_fmt))) {
+    return 0;
+  }
+  // layers are placed in the current layout and can not be moved for the other clients
+  if (frame_num_layers) {
+    return -EBUSY;
+  }
+  // the fade buffers have the old length
+  frame_fade_cancel();
+  // the new buffers are allocated up front so a failure leaves the current ones alone
+  buf = (char *)vmalloc_user(PAGE_ALIGN(len));
+  out = (char *)vzalloc(len);
+  comp = (char *)vmalloc(len);
+  shown = (char *)vmalloc(len);
+  err = (buf && out && comp && shown) ? pacer_resize(len) : -ENOMEM;
+  if (!err) {
+    err = frame_set_params(strip, fmt);
+  }
+  if (!err) {
+    // the hardware frees the slots and stops any animation even if this fails
+    err = hal_configure();
+    frame_free_shown();
+    if (err) {
+      // go back to the previous layout. that can fail as well (memory or pins), the hardware
+      // then has no strip and refuses frames until a later layout succeeds.
+      frame_has_strip = !frame_set_params(&old_strip, &old_fmt) && !hal_configure();
+      if (!frame_has_strip) {
+        printk(KERN_ALERT "%s: (frame_reconfigure) cannot restore the previous strip layout\n", DRIVER_NAME);
+      }
+    }
+  }
+  if (err) {
+    // the ring never shrinks so this can not fail
+    pacer_resize(frame_len);
+    vfree(shown);
+    vfree(comp);
+    vfree(out);
+    vfree(buf);
+    return err;
+  }
+  // existing mappings keep the old pages until they are unmapped
+  vfree(frame_shown);
+  vfree(frame_comp);
+  vfree(frame_out);
+  vfree(frame_buf);
+  frame_buf = buf;
+  frame_out = out;
+  frame_comp = comp;
+  frame_shown = shown;
+  frame_len = len;
+  frame_has_strip = 1;
+  printk(KERN_INFO "%s: (frame_reconfigure) %d WS281x LEDs on GPIO %d, %d on GPIO %d\n", DRIVER_NAME, num_leds, pin_num, num_leds2, pin_num2);
+  return 0;
+}
+
+
+int frame_init(void) {
+  int c, i, err;
+  // the encoder converts the pixel format on the way in
+  if (encoder_set_format(pixel_format, wire_format)) {
+    printk(KERN_ALERT "%s: (frame_init) invalid pixel format %d or wire format %d\n", DRIVER_NAME, pixel_format, wire_format);
+    return -EINVAL;
+  }
+  // the second strip's pixels (if any) follow the first strip's pixels
+  frame_len = (num_leds + num_leds2) * encoder_pixel_len();
+  // vmalloc_user() returns zeroed memory that is safe to map into userspace
+  frame_buf = (char *)vmalloc_user(PAGE_ALIGN(frame_len));
+  if (!frame_buf) {
+    printk(KERN_ALERT "%s: (frame_init) vmalloc_user error\n", DRIVER_NAME);
+    return -ENOMEM;
+  }
+  frame_out = (char *)vzalloc(frame_len);
+  frame_comp = (char *)vmalloc(frame_len);
+  frame_shown = (char *)vmalloc(frame_len);
+  if (!frame_out || !frame_comp || !frame_shown) {
+    printk(KERN_ALERT "%s: (frame_init) vzalloc error\n", DRIVER_NAME);
+    vfree(frame_shown);
+    vfree(frame_comp);
+    vfree(frame_out);
+    vfree(frame_buf);
+    return -ENOMEM;
+  }
+  err = pacer_init(frame_len);
+  if (err) {
+    vfree(frame_shown);
+    vfree(frame_comp);
+    vfree(frame_out);
+    vfree(frame_buf);
+    return err;
+  }
+  err = fade_init();
+  if (err) {
+    pacer_cleanup();
+    vfree(frame_shown);
+    vfree(frame_comp);
+    vfree(frame_out);
+    vfree(frame_buf);
+    return err;
+  }
+  // full brightness with no color correction
+  for (c = 0; c < ENCODER_MAX_COMPONENTS; c++) {
+    for (i = 0; i < 256; i++) {
+      frame_lut[c][i] = i;
+    }
+  }
+  frame_brightness = WS281x_BRIGHTNESS_MAX;
+  // the hardware is brought up once and stays up until the module is unloaded
+  err = hal_init();
+  if (err) {
+    fade_cleanup();
+    pacer_cleanup();
+    vfree(frame_shown);
+    vfree(frame_comp);
+    vfree(frame_out);
+    vfree(frame_buf);
+    return err;
+  }
+  frame_has_strip = 1;
+  return 0;
+}
+
+
+struct frame_layer *frame_open(void) {
+  // every file draws into the shared pixel buffer until it sets a layer
+  return kzalloc(sizeof(struct frame_layer), GFP_KERNEL);
+}
+
+
+ssize_t frame_write(struct frame_layer *layer, struct iov_iter *from, loff_t off, int nonblock) {
+  int err;
+  size_t count = iov_iter_count(from), len = count, base, size;
+  char *dst;
+  if (off < 0) {
+    return -EINVAL;
+  }
+  err = frame_lock_room(nonblock);
+  if (err) {
+    return err;
+  }
+  dst = frame_target(layer, &base, &size);
+  if (off >= size) {
+    err = -EINVAL;
+  } else {
+    // extra data past the end of the strip or layer is ignored
+    if (len > size - off) {
+      len = size - off;
+    }
+    if (copy_from_iter(dst + off, len, from) != len) {
+      err = -EFAULT;
+    } else {
+      err = frame_submit(base + off, len);
+    }
+  }
+  mutex_unlock(&frame_lock);
+  if (err) {
+    return err;
+  }
+  return count;
+}
+
+
+int frame_update(struct frame_layer *layer, const struct ws281x_update __user *arg, int nonblock) {
+  struct ws281x_update update;
+  struct ws281x_run run;
+  const struct ws281x_run __user *runs;
+  const char *src = frame_buf;
+  char *dst;
+  size_t lo, hi, base, size;
+  uint32_t i;
+  int err = 0;
+  if (copy_from_user(&update, arg, sizeof(update))) {
+    return -EFAULT;
+  }
+  if (update.reserved || update.num_runs > frame_len) {
+    return -EINVAL;
+  }
+  runs = (const struct ws281x_run __user *)(uintptr_t)update.runs;
+  err = frame_lock_room(nonblock);
+  if (err) {
+    return err;
+  }
+  frame_fade_cancel();
+  // apply every run to the pixel buffer or layer and track the range they cover
+  dst = frame_target(layer, &base, &size);
+  lo = size;
+  hi = 0;
+  for (i = 0; i < update.num_runs; i++) {
+    if (copy_from_user(&run, &runs[i], sizeof(run))) {
+      err = -EFAULT;
+      break;
+    }
+    if (run.start >= size || run.len > size - run.start) {
+      err = -EINVAL;
+      break;
+    }
+    // runs without data were already written through mmap()
+    if (run.data && copy_from_user(dst + run.start, (const void __user *)(uintptr_t)run.data, run.len)) {
+      err = -EFAULT;
+      break;
+    }
+    src = frame_compose(base + run.start, run.len);
+    if (!pacer_enabled()) {
+      frame_sync(src, base + run.start, run.len);
+    }
+    lo = min(lo, (size_t)run.start);
+    hi = max(hi, (size_t)run.start + run.len);
+  }
+  if (!err && hi > lo) {
+    // the runs were already compared one by one so only the hardware needs to be updated
+    err = pacer_enabled() ? pacer_push(src) : frame_render();
+  }
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_commit(struct frame_layer *layer, int nonblock) {
+  size_t base, size;
+  int err = frame_lock_room(nonblock);
+  if (err) {
+    return err;
+  }
+  frame_target(layer, &base, &size);
+  err = frame_submit(base, size);
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_play(const struct ws281x_anim __user *arg) {
+  struct ws281x_anim anim;
+  char *frames;
+  int err;
+  if (copy_from_user(&anim, arg, sizeof(anim))) {
+    return -EFAULT;
+  }
+  if (anim.reserved || (anim.flags & ~WS281x_ANIM_LOOP) || !anim.num_frames ||
+      anim.num_frames > WS281x_ANIM_MAX_FRAMES || anim.frame_us > WS281x_ANIM_MAX_US) {
+    return -EINVAL;
+  }
+  // the frames are kept while the animation plays so a fade can start from the one shown
+  frames = (char *)vmalloc(anim.num_frames * frame_len);
+  if (!frames) {
+    return -ENOMEM;
+  }
+  if (copy_from_user(frames, (const void __user *)(uintptr_t)anim.frames, anim.num_frames * frame_len)) {
+    vfree(frames);
+    return -EFAULT;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (!err) {
+    frame_fade_cancel();
+    // the animation being replaced is stopped here so the frame it leaves behind is known if
+    // this one fails
+    frame_stop_anim();
+    err = hal_play(frames, anim.num_frames, anim.frame_us, anim.flags & WS281x_ANIM_LOOP);
+    if (!err) {
+      swap(frame_anim, frames);
+      frame_shown_set = 0;
+    }
+    mutex_unlock(&frame_lock);
+  }
+  vfree(frames);
+  return err;
+}
+
+
+int frame_stop(void) {
+  int err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  frame_stop_anim();
+  mutex_unlock(&frame_lock);
+  return 0;
+}
+
+
+int frame_slot_store(const struct ws281x_slot __user *arg) {
+  struct ws281x_slot slot;
+  char *buf = NULL;
+  int err;
+  if (copy_from_user(&slot, arg, sizeof(slot))) {
+    return -EFAULT;
+  }
+  if (slot.reserved || slot.slot >= WS281x_MAX_SLOTS) {
+    return -EINVAL;
+  }
+  // the pixel data is kept with the slot so a fade can start from it while it is shown
+  buf = (char *)vmalloc(frame_len);
+  if (!buf) {
+    return -ENOMEM;
+  }
+  if (slot.data && copy_from_user(buf, (const void __user *)(uintptr_t)slot.data, frame_len)) {
+    vfree(buf);
+    return -EFAULT;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (!err) {
+    if (!slot.data) {
+      memcpy(buf, frame_compose(0, frame_len), frame_len);
+    }
+    err = hal_slot_store(slot.slot, buf);
+    if (!err) {
+      swap(frame_slots[slot.slot], buf);
+    }
+    mutex_unlock(&frame_lock);
+  }
+  vfree(buf);
+  return err;
+}
+
+
+int frame_slot_show(unsigned long slot) {
+  int err;
+  if (slot >= WS281x_MAX_SLOTS) {
+    return -EINVAL;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  frame_fade_cancel();
+  err = hal_slot_show(slot);
+  if (!err) {
+    // any animation was stopped by the slot
+    vfree(frame_anim);
+    frame_anim = NULL;
+    memcpy(frame_shown, frame_slots[slot], frame_len);
+    frame_shown_set = 1;
+  }
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_set_lut(const struct ws281x_lut __user *arg) {
+  int err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  if (copy_from_user(frame_lut, arg->lut, sizeof(frame_lut))) {
+    err = -EFAULT;
+  } else {
+    err = frame_apply_lut();
+  }
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_set_brightness(unsigned long brightness) {
+  int err;
+  if (brightness > WS281x_BRIGHTNESS_MAX) {
+    return -EINVAL;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  frame_brightness = brightness;
+  err = frame_apply_lut();
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_set_format(const struct ws281x_format __user *arg) {
+  struct ws281x_format fmt, old_fmt;
+  struct ws281x_strip strip;
+  int err;
+  if (copy_from_user(&fmt, arg, sizeof(fmt))) {
+    return -EFAULT;
+  }
+  // a format with a different number of bytes per pixel needs new buffers
+  if (encoder_format_len(fmt.pixel_format) != encoder_pixel_len() || encoder_format_len(fmt.wire_format) != encoder_wire_len()) {
+    mutex_lock(&ws281x_mutex);
+    pacer_stop();
+    mutex_lock(&frame_lock);
+    frame_get_params(&strip, &old_fmt);
+    err = frame_reconfigure(&strip, &fmt);
+    mutex_unlock(&frame_lock);
+    pacer_start();
+    mutex_unlock(&ws281x_mutex);
+    return err;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  if (encoder_set_format(fmt.pixel_format, fmt.wire_format)) {
+    err = -EINVAL;
+  } else {
+    pixel_format = fmt.pixel_format;
+    wire_format = fmt.wire_format;
+    // the pixel buffer is now read in the new format, so send all of it
+    hal_invalidate(0, frame_len);
+    err = frame_render();
+  }
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_set_strip(const struct ws281x_strip __user *arg) {
+  struct ws281x_strip strip, old_strip;
+  struct ws281x_format fmt;
+  int err;
+  if (copy_from_user(&strip, arg, sizeof(strip))) {
+    return -EFAULT;
+  }
+  // the timer work takes frame_lock so it has to be stopped before taking the lock, and
+  // ws281x_mutex keeps other files from starting or stopping it in between
+  mutex_lock(&ws281x_mutex);
+  pacer_stop();
+  mutex_lock(&frame_lock);
+  frame_get_params(&old_strip, &fmt);
+  err = frame_reconfigure(&strip, &fmt);
+  mutex_unlock(&frame_lock);
+  pacer_start();
+  mutex_unlock(&ws281x_mutex);
+  return err;
+}
+
+
+int frame_get_strip(struct ws281x_strip __user *arg) {
+  struct ws281x_strip strip;
+  struct ws281x_format fmt;
+  int err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  frame_get_params(&strip, &fmt);
+  mutex_unlock(&frame_lock);
+  if (copy_to_user(arg, &strip, sizeof(strip))) {
+    return -EFAULT;
+  }
+  return 0;
+}
+
+
+int frame_set_pacing(unsigned int hz, unsigned int policy) {
+  int err;
+  // the timer work takes frame_lock so it has to be stopped before taking the lock, and
+  // ws281x_mutex keeps other files from starting or stopping it in between
+  mutex_lock(&ws281x_mutex);
+  pacer_stop();
+  mutex_lock(&frame_lock);
+  frame_fade_cancel();
+  err = pacer_configure(hz, policy);
+  // frames that were still pending are dropped but the pixel buffer already holds the latest
+  // one so render it directly
+  if (!err) {
+    frame_sync(frame_compose(0, frame_len), 0, frame_len);
+    err = frame_render();
+  }
+  mutex_unlock(&frame_lock);
+  pacer_start();
+  mutex_unlock(&ws281x_mutex);
+  return err;
+}
+
+
+void frame_tick(void) {
+  const char *next;
+  mutex_lock(&frame_lock);
+  next = pacer_pop();
+  if (next) {
+    frame_fade_cancel();
+    frame_sync(next, 0, frame_len);
+    frame_render();
+  }
+  mutex_unlock(&frame_lock);
+}
+
+
+int frame_fade(struct frame_layer *layer, const struct ws281x_fade __user *arg) {
+  struct ws281x_fade fade;
+  size_t base, size;
+  char *buf, *dst;
+  int err;
+  if (copy_from_user(&fade, arg, sizeof(fade))) {
+    return -EFAULT;
+  }
+  if (fade.reserved || fade.easing > WS281x_EASE_IN_OUT || fade.duration_ms > WS281x_FADE_MAX_MS ||
+      fade.frame_us > WS281x_ANIM_MAX_US) {
+    return -EINVAL;
+  }
+  err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  // the start, end and intermediate frames
+  buf = (char *)vmalloc(3 * frame_len);
+  if (!buf) {
+    mutex_unlock(&frame_lock);
+    return -ENOMEM;
+  }
+  dst = frame_target(layer, &base, &size);
+  if (fade.data && copy_from_user(dst, (const void __user *)(uintptr_t)fade.data, size)) {
+    mutex_unlock(&frame_lock);
+    vfree(buf);
+    return -EFAULT;
+  }
+  // the fade replaces anything still pending and starts from what the LEDs are showing: a slot,
+  // the frame an animation is stopped on, or the last frame rendered (an intermediate frame if
+  // another fade is running)
+  frame_stop_anim();
+  pacer_drop();
+  memcpy(buf, frame_shown_set ? frame_shown : frame_out, frame_len);
+  memcpy(buf + frame_len, frame_compose(0, frame_len), frame_len);
+  vfree(frame_fade_buf);
+  frame_fade_buf = buf;
+  fade_start(fade.duration_ms, fade.frame_us, fade.easing);
+  mutex_unlock(&frame_lock);
+  return 0;
+}
+
+
+int frame_fade_tick(void) {
+  unsigned int progress;
+  int more = 0;
+  mutex_lock(&frame_lock);
+  if (frame_fade_buf) {
+    progress = fade_progress();
+    // only the bytes that changed since the previous intermediate frame are encoded again
+    frame_lerp(frame_fade_buf + (2 * frame_len), frame_fade_buf, frame_fade_buf + frame_len, frame_len, progress);
+    frame_sync(frame_fade_buf + (2 * frame_len), 0, frame_len);
+    frame_render();
+    if (progress < FADE_ONE) {
+      more = 1;
+    } else {
+      frame_fade_cancel();
+    }
+  }
+  mutex_unlock(&frame_lock);
+  return more;
+}
+
+
+int frame_set_layer(struct frame_layer *layer, const struct ws281x_layer __user *arg) {
+  struct ws281x_layer req;
+  struct frame_layer *pos;
+  size_t pixel_len, leds, len;
+  char *buf = NULL;
+  int err;
+  if (copy_from_user(&req, arg, sizeof(req))) {
+    return -EFAULT;
+  }
+  if (req.alpha > WS281x_ALPHA_OPAQUE) {
+    return -EINVAL;
+  }
+  err = frame_lock_room(0);
+  if (err) {
+    return err;
+  }
+  pixel_len = encoder_pixel_len();
+  leds = frame_len / pixel_len;
+  len = (size_t)req.len * pixel_len;
+  if (req.len && (req.start >= leds || req.len > leds - req.start)) {
+    err = -EINVAL;
+  } else if (req.len && !layer->buf && frame_num_layers >= WS281x_MAX_LAYERS) {
+    err = -ENOSPC;
+  } else if (req.len && layer->buf && len == layer->len) {
+    // only the position, priority or alpha change, the pixel data is kept
+    buf = layer->buf;
+  } else if (req.len) {
+    // a new layer starts out with the pixels below it so setting it changes nothing on the LEDs
+    buf = (char *)vmalloc_user(PAGE_ALIGN(len));
+    if (!buf) {
+      err = -ENOMEM;
+    } else {
+      memcpy(buf, frame_buf + (req.start * pixel_len), len);
+    }
+  }
+  if (err) {
+    mutex_unlock(&frame_lock);
+    return err;
+  }
+  if (layer->buf) {
+    list_del(&layer->node);
+    frame_num_layers--;
+    // existing mappings keep the old pages until they are unmapped
+    if (layer->buf != buf) {
+      vfree(layer->buf);
+    }
+  }
+  layer->buf = buf;
+  if (buf) {
+    layer->off = req.start * pixel_len;
+    layer->len = len;
+    layer->priority = req.priority;
+    layer->alpha = req.alpha;
+    // keep the list sorted, a layer goes on top of the layers with the same priority
+    list_for_each_entry(pos, &frame_layers, node) {
+      if (pos->priority > layer->priority) {
+        break;
+      }
+    }
+    list_add_tail(&layer->node, &pos->node);
+    frame_num_layers++;
+  }
+  // both the old and the new range of the layer may change, so composite the whole frame
+  err = frame_submit(0, frame_len);
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+int frame_mmap(struct frame_layer *layer, struct vm_area_struct *vma) {
+  size_t base, size;
+  char *buf;
+  int err = mutex_lock_interruptible(&frame_lock);
+  if (err) {
+    return err;
+  }
+  buf = frame_target(layer, &base, &size);
+  // only the whole buffer (or a prefix of it) can be mapped
+  if (vma->vm_pgoff || (vma->vm_end - vma->vm_start) > PAGE_ALIGN(size)) {
+    err = -EINVAL;
+  } else {
+    err = remap_vmalloc_range(vma, buf, 0);
+  }
+  mutex_unlock(&frame_lock);
+  return err;
+}
+
+
+__poll_t frame_poll(struct file *filep, poll_table *wait) {
+  pacer_poll_wait(filep, wait);
+  hal_poll_wait(filep, wait);
+  // read without frame_lock, a writer holding it only delays the next frame by its encode
+  return frame_ready() ? (EPOLLOUT | EPOLLWRNORM) : 0;
+}
+
+
+void frame_close(struct frame_layer *layer) {
+  int err;
+  if (layer->buf) {
+    mutex_lock(&frame_lock);
+    list_del(&layer->node);
+    frame_num_layers--;
+    // the pixels below the layer show again
+    err = frame_submit(layer->off, layer->len);
+    if (err == -EAGAIN && pacer_enabled()) {
+      // a closing file can not wait for room in the ring, so the newest pending frame (which
+      // still has the layer drawn on it) is replaced by the current one
+      pacer_push_over(frame_compose(layer->off, layer->len));
+      err = 0;
+    }
+    if (err) {
+      printk(KERN_ALERT "%s: (frame_close) cannot render the pixels below the layer (%d)\n", DRIVER_NAME, err);
+    }
+    mutex_unlock(&frame_lock);
+    vfree(layer->buf);
+  }
+  kfree(layer);
+}
+
+
+void frame_cleanup(void) {
+  // the fade timer work stops once no fade is running
+  mutex_lock(&frame_lock);
+  frame_fade_cancel();
+  frame_free_shown();
+  mutex_unlock(&frame_lock);
+  fade_cleanup();
+  hal_cleanup();
+  pacer_cleanup();
+  vfree(frame_shown);
+  vfree(frame_comp);
+  vfree(frame_out);
+  vfree(frame_buf);
+}
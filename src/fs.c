@@ -12,25 +12,39 @@
 #include <linux/err.h>           /* for error checking functions like IS_ERR() */
 #include <linux/device.h>        /* for device_create/destroy */
 #include <linux/kernel.h>        /* for printk KERN_INFO */
+#include <linux/uaccess.h>       /* for copy_from_user() */
+#include <linux/uio.h>           /* for struct iov_iter */
+#include <linux/poll.h>          /* for poll_table */
 #include <asm/errno.h>           /* for linux error return codes */
 
-#include <hal.h>                 /* for hardware interface functions */
+#include <frame.h>               /* for the pixel buffer */
+#include <pacer.h>               /* for the refresh timer */
 #include <WS281x.h>              /* for module info */
+#include <WS281x_ioctl.h>        /* for ioctl definitions */
+#include <WS281x_trace.h>         /* for tracepoints */
 
 #define CLASS_NAME "ws281x"
 
 static int major_num;             /* major number for this driver */
 static struct class* class_ptr;   /* device driver class struct pointer */
 static struct device* device_ptr; /* device driver device struct pointer */
+static unsigned int open_count;   /* number of open files (protected by ws281x_mutex) */
 
 /* file system function signatures */
 static int fs_open(struct inode *inode, struct file *filep);
 static int fs_release(struct inode *inode, struct file *filep);
-static ssize_t fs_write(struct file *filep, const char *buf, size_t len, loff_t * offset);
+static ssize_t fs_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static __poll_t fs_poll(struct file *filep, poll_table *wait);
+static int fs_mmap(struct file *filep, struct vm_area_struct *vma);
+static long fs_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
 
 /* file system function hooks */
 static struct file_operations fops = {
-  .write = fs_write,
+  .owner = THIS_MODULE,
+  .write_iter = fs_write_iter,
+  .poll = fs_poll,
+  .mmap = fs_mmap,
+  .unlocked_ioctl = fs_ioctl,
   .open = fs_open,
   .release = fs_release
 };
@@ -77,16 +91,19 @@ void cleanup_fs(void) {
  * Called when a process tries to open the device file
  */
 static int fs_open(struct inode *inode, struct file *filep) {
-  int err;
-  // try to get driver mutex
-  if (!mutex_trylock(&ws281x_mutex)) {
-    printk(KERN_ALERT "%s: (fs_open) driver in use by another process\n", DRIVER_NAME);
-    return -EBUSY;
+  // any number of processes can draw, each file into the shared pixel buffer or its own layer
+  filep->private_data = frame_open();
+  if (!filep->private_data) {
+    return -ENOMEM;
   }
-  err = hal_init();
-  if (err) {
-    return err;
+  // io_uring tries writes with IOCB_NOWAIT first and only falls back to a worker on -EAGAIN
+  filep->f_mode |= FMODE_NOWAIT;
+  mutex_lock(&ws281x_mutex);
+  // the hardware is already up since module load, only the refresh timer is started
+  if (open_count++ == 0) {
+    pacer_start();
   }
+  mutex_unlock(&ws281x_mutex);
   return 0;
 }
 
@@ -95,24 +112,108 @@ static int fs_open(struct inode *inode, struct file *filep) {
  * Called when a process closes the device file
  */
 static int fs_release(struct inode *inode, struct file *filep) {
-  hal_cleanup();
+  frame_close(filep->private_data);
+  mutex_lock(&ws281x_mutex);
+  // an animation keeps playing without any open file, the hardware stays up until unload
+  if (--open_count == 0) {
+    pacer_stop();
+  }
   mutex_unlock(&ws281x_mutex);
   return 0;
 }
 
 
 /*
- * Called when a process writes to the device file
+ * Called when a process writes to the device file (write(), pwrite(), writev() or io_uring)
+ *
+ * iocb - I/O control block with the file, the offset and the IOCB_* flags
+ * from - data from the user
+ *
+ * returns the number of bytes written or a negative error code
+ */
+static ssize_t fs_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  struct file *filep = iocb->ki_filp;
+  int nonblock = (filep->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+  // copy the data into the pixel buffer at the offset and render it. the offset is not
+  // advanced so plain write() calls always update the frame from the first pixel.
+  trace_ws281x_write(iocb->ki_pos, iov_iter_count(from));
+  return frame_write(filep->private_data, from, iocb->ki_pos, nonblock);
+}
+
+
+/*
+ * Called when a process polls the device file. it is writable once another frame can be
+ * written without blocking.
+ *
+ * filp - file pointer from include/linux/fs.h
+ * wait - poll table of the caller
+ *
+ * returns the poll event mask
+ */
+static __poll_t fs_poll(struct file *filep, poll_table *wait) {
+  return frame_poll(filep, wait);
+}
+
+
+/*
+ * Called when a process mmap()s the device file to get direct access to the pixel buffer
  *
  * filp - file pointer from include/linux/fs.h
- * buf - buffer with data from the user
- * len - length of that buffer
- * offset - current offset into the file
+ * vma - user virtual memory area to map the pixel buffer into
  *
- * returns the number of bytes written
+ * returns 0 on success or a negative error code
  */
-static ssize_t fs_write(struct file *filep, const char *buf, size_t len, loff_t * offset) {
-  // render the buffer
-  hal_render(buf, len);
-  return len;
+static int fs_mmap(struct file *filep, struct vm_area_struct *vma) {
+  return frame_mmap(filep->private_data, vma);
+}
+
+
+/*
+ * Called when a process issues an ioctl on the device file
+ *
+ * filp - file pointer from include/linux/fs.h
+ * cmd - one of the WS281x_IOC_* commands
+ * arg - command specific argument
+ *
+ * returns 0 on success or a negative error code
+ */
+static long fs_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+  struct ws281x_pacing pacing;
+  int nonblock = filep->f_flags & O_NONBLOCK;
+  trace_ws281x_ioctl(cmd);
+  switch (cmd) {
+    case WS281x_IOC_COMMIT:
+      return frame_commit(filep->private_data, nonblock);
+    case WS281x_IOC_UPDATE:
+      return frame_update(filep->private_data, (const struct ws281x_update __user *)arg, nonblock);
+    case WS281x_IOC_SET_PACING:
+      if (copy_from_user(&pacing, (const void __user *)arg, sizeof(pacing))) {
+        return -EFAULT;
+      }
+      return frame_set_pacing(pacing.refresh_hz, pacing.policy);
+    case WS281x_IOC_PLAY:
+      return frame_play((const struct ws281x_anim __user *)arg);
+    case WS281x_IOC_STOP:
+      return frame_stop();
+    case WS281x_IOC_SLOT_STORE:
+      return frame_slot_store((const struct ws281x_slot __user *)arg);
+    case WS281x_IOC_SLOT_SHOW:
+      return frame_slot_show(arg);
+    case WS281x_IOC_SET_LUT:
+      return frame_set_lut((const struct ws281x_lut __user *)arg);
+    case WS281x_IOC_SET_BRIGHTNESS:
+      return frame_set_brightness(arg);
+    case WS281x_IOC_SET_FORMAT:
+      return frame_set_format((const struct ws281x_format __user *)arg);
+    case WS281x_IOC_SET_STRIP:
+      return frame_set_strip((const struct ws281x_strip __user *)arg);
+    case WS281x_IOC_GET_STRIP:
+      return frame_get_strip((struct ws281x_strip __user *)arg);
+    case WS281x_IOC_SET_LAYER:
+      return frame_set_layer(filep->private_data, (const struct ws281x_layer __user *)arg);
+    case WS281x_IOC_FADE:
+      return frame_fade(filep->private_data, (const struct ws281x_fade __user *)arg);
+    default:
+      return -ENOTTY;
+  }
 }
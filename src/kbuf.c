@@ -0,0 +1,328 @@
+/*
+ * kbuf.c
+ *
+ * Bookkeeping shared by the platforms for the encoded (PWM) buffers: layout of the strips,
+ * pixels that changed since each buffer was last encoded and how much of a frame to send
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h> /* for printk KERN_INFO and min/max */
+#include <linux/bitmap.h> /* for dirty pixel tracking */
+#include <linux/slab.h>   /* for kcalloc() */
+#include <linux/ktime.h>  /* for ktime_get_ns() */
+#include <linux/workqueue.h> /* for the parallel encode */
+#include <linux/cpumask.h> /* for for_each_online_cpu() */
+#include <linux/atomic.h> /* for handing out chunks */
+#include <asm/errno.h>    /* for linux error return codes */
+
+#include <kbuf.h>         /* for interface definition */
+#include <encoder.h>      /* for the table driven pixel encoder */
+#include <stats.h>        /* for performance counters */
+#include <WS281x_trace.h> /* for tracepoints */
+#include <WS281x.h>       /* for WS281x macros and user parameters */
+
+int kbuf_chans;
+size_t kbuf_chan_off[NUM_CHANS];
+size_t kbuf_chan_len[NUM_CHANS];
+size_t kbuf_chan_leds[NUM_CHANS];
+size_t kbuf_frame_len;
+size_t kbuf_len;
+
+/* bytes of pixel data per pixel in the current pixel format */
+static size_t pixel_len;
+
+/* number of pixels that fill a whole number of encoded words, runs are encoded in whole groups */
+static size_t group_len;
+
+/* total number of pixels in a frame (the second strip's pixels follow the first strip's) */
+static size_t frame_pixels;
+
+/* per buffer bitmap of pixels that changed since that buffer was last encoded */
+static unsigned long *kbuf_dirty[NUM_KBUFS];
+
+/* end of the changed pixels of each channel since the last frame was sent */
+static size_t tx_end[NUM_CHANS];
+
+/* encode work items running on the other CPUs, one per CPU */
+struct kbuf_worker {
+  struct work_struct work;
+  size_t count; /* pixels encoded */
+  int queued;
+};
+
+/* workqueue bound to the CPUs the encode work items are queued on */
+static struct workqueue_struct *kbuf_wq;
+static struct kbuf_worker *kbuf_workers;
+
+/* frame being encoded in chunks by every CPU: the changed pixels of each channel up to stop are
+ * split into chunks of KBUF_CHUNK_LEN pixels, the ones of the second channel follow the ones
+ * of the first, and next is the next chunk that nobody took yet */
+static struct {
+  char *dst;
+  const char *buf;
+  const unsigned long *dirty;
+  unsigned long stop[NUM_CHANS];
+  unsigned long chunks[NUM_CHANS];
+  atomic_t next;
+} kbuf_job;
+
+
+/*
+ * encodes a run of changed pixels of one channel. the words of each channel are interleaved
+ * when a second strip is in use.
+ *
+ * dst - encoded buffer
+ * buf - complete frame of pixel data
+ * chan - channel the run belongs to
+ * start - first pixel of the run on the channel (a multiple of group_len)
+ * end - pixel after the end of the run on the channel
+ */
+static void kbuf_encode_run(char *dst, const char *buf, int chan, size_t start, size_t end) {
+  uint32_t *words = (uint32_t *)dst + (encoder_words(start) * kbuf_chans) + chan;
+  encoder_run(words, (const uint8_t *)buf + kbuf_chan_off[chan] + (start * pixel_len), end - start, kbuf_chans);
+}
+
+
+/*
+ * encodes the runs of changed pixels of one channel between two pixels of the frame. runs are
+ * widened to whole groups but not past a limit. the dirty bitmap is only read so several
+ * ranges can be encoded at the same time. returns the number of pixels encoded.
+ *
+ * dst - encoded buffer
+ * buf - complete frame of pixel data
+ * dirty - changed pixels
+ * chan - channel the pixels belong to
+ * first - first pixel to look at (group aligned on the channel)
+ * stop - pixel to stop looking at
+ * limit - pixel runs can be widened up to (group aligned on the channel or its end)
+ */
+static size_t kbuf_encode_dirty(char *dst, const char *buf, const unsigned long *dirty, int chan,
+                                unsigned long first, unsigned long stop, unsigned long limit) {
+  unsigned long start, end, chan_first = kbuf_chan_off[chan] / pixel_len;
+  size_t count = 0;
+  for (start = find_next_bit(dirty, stop, first); start < stop; start = find_next_bit(dirty, stop, end)) {
+    end = find_next_zero_bit(dirty, stop, start);
+    // runs are widened to whole groups, the extra pixels are encoded from the same frame
+    start = chan_first + rounddown(start - chan_first, group_len);
+    end = min_t(unsigned long, chan_first + roundup(end - chan_first, group_len), limit);
+    kbuf_encode_run(dst, buf, chan, start - chan_first, end - chan_first);
+    count += end - start;
+  }
+  return count;
+}
+
+
+/*
+ * takes chunks of the frame being encoded until there are none left. returns the number of
+ * pixels encoded.
+ */
+static size_t kbuf_encode_chunks(void) {
+  unsigned long k, first, limit, chan_first;
+  size_t count = 0;
+  int chan;
+  while ((k = atomic_inc_return(&kbuf_job.next) - 1) < kbuf_job.chunks[0] + kbuf_job.chunks[1]) {
+    chan = (k >= kbuf_job.chunks[0]);
+    if (chan) {
+      k -= kbuf_job.chunks[0];
+    }
+    // chunks are a multiple of every group length so no two of them share an encoded word
+    chan_first = kbuf_chan_off[chan] / pixel_len;
+    first = chan_first + (k * KBUF_CHUNK_LEN);
+    limit = chan_first + min_t(unsigned long, first - chan_first + KBUF_CHUNK_LEN, kbuf_chan_leds[chan]);
+    count += kbuf_encode_dirty(kbuf_job.dst, kbuf_job.buf, kbuf_job.dirty, chan, first, min(limit, kbuf_job.stop[chan]), limit);
+  }
+  return count;
+}
+
+
+/*
+ * encode work item of one CPU
+ */
+static void kbuf_work_fn(struct work_struct *work) {
+  struct kbuf_worker *worker = container_of(work, struct kbuf_worker, work);
+  worker->count = kbuf_encode_chunks();
+}
+
+
+/*
+ * encodes the frame set up in kbuf_job on the calling CPU and every other online CPU and waits
+ * for all of them. returns the number of pixels encoded.
+ */
+static size_t kbuf_encode_parallel(void) {
+  unsigned int cpu, self = raw_smp_processor_id(), helpers = 0;
+  size_t count;
+  atomic_set(&kbuf_job.next, 0);
+  // the calling CPU takes chunks too, so only the other CPUs get a work item
+  for_each_online_cpu(cpu) {
+    if (cpu == self || helpers + 1 >= kbuf_job.chunks[0] + kbuf_job.chunks[1]) {
+      continue;
+    }
+    kbuf_workers[cpu].count = 0;
+    kbuf_workers[cpu].queued = queue_work_on(cpu, kbuf_wq, &kbuf_workers[cpu].work);
+    helpers++;
+  }
+  count = kbuf_encode_chunks();
+  // the frame can only be sent once every chunk is encoded
+  for_each_possible_cpu(cpu) {
+    if (kbuf_workers[cpu].queued) {
+      flush_work(&kbuf_workers[cpu].work);
+      count += kbuf_workers[cpu].count;
+      kbuf_workers[cpu].queued = 0;
+    }
+  }
+  return count;
+}
+
+
+int kbuf_init(void) {
+  int i;
+  unsigned int cpu;
+  // lay out the pixel data of each strip in the frame
+  pixel_len = encoder_pixel_len();
+  group_len = encoder_group_len();
+  kbuf_chans = (num_leds2 > 0) ? 2 : 1;
+  kbuf_chan_leds[0] = num_leds;
+  kbuf_chan_leds[1] = (kbuf_chans > 1) ? num_leds2 : 0;
+  kbuf_chan_off[0] = 0;
+  kbuf_chan_len[0] = kbuf_chan_leds[0] * pixel_len;
+  kbuf_chan_off[1] = kbuf_chan_len[0];
+  kbuf_chan_len[1] = kbuf_chan_leds[1] * pixel_len;
+  kbuf_frame_len = kbuf_chan_len[0] + kbuf_chan_len[1];
+  frame_pixels = kbuf_chan_leds[0] + kbuf_chan_leds[1];
+  // every channel gets the encoded words of the longer strip
+  kbuf_len = encoder_words(max(kbuf_chan_leds[0], kbuf_chan_leds[1])) * ENCODER_WORD_LEN * kbuf_chans;
+  for (i = 0; i < NUM_KBUFS; i++) {
+    // every pixel needs to be encoded before the first frame is sent
+    kbuf_dirty[i] = kcalloc(BITS_TO_LONGS(frame_pixels), sizeof(unsigned long), GFP_KERNEL);
+    if (!kbuf_dirty[i]) {
+      printk(KERN_ALERT "%s: (kbuf_init) kcalloc error\n", DRIVER_NAME);
+      kbuf_cleanup();
+      return -ENOMEM;
+    }
+    bitmap_set(kbuf_dirty[i], 0, frame_pixels);
+  }
+  for (i = 0; i < NUM_CHANS; i++) {
+    tx_end[i] = kbuf_chan_leds[i];
+  }
+  // one work item per CPU for encoding large frames in parallel
+  kbuf_wq = alloc_workqueue("%s_encode", WQ_HIGHPRI, 0, DRIVER_NAME);
+  kbuf_workers = kcalloc(nr_cpu_ids, sizeof(struct kbuf_worker), GFP_KERNEL);
+  if (!kbuf_wq || !kbuf_workers) {
+    printk(KERN_ALERT "%s: (kbuf_init) encode workqueue allocation error\n", DRIVER_NAME);
+    kbuf_cleanup();
+    return -ENOMEM;
+  }
+  for_each_possible_cpu(cpu) {
+    INIT_WORK(&kbuf_workers[cpu].work, kbuf_work_fn);
+  }
+  return 0;
+}
+
+
+void kbuf_invalidate(size_t start, size_t len) {
+  int i;
+  size_t first, last, chan_first;
+  // never track more pixel data than the strips have room for
+  if (start >= kbuf_frame_len || !len) {
+    return;
+  }
+  if (len > kbuf_frame_len - start) {
+    len = kbuf_frame_len - start;
+  }
+  // every pixel touched by the range is encoded again as a whole
+  first = start / pixel_len;
+  last = DIV_ROUND_UP(start + len, pixel_len);
+  for (i = 0; i < NUM_KBUFS; i++) {
+    bitmap_set(kbuf_dirty[i], first, last - first);
+  }
+  // pixels after the last changed one keep their color so they do not need to be sent
+  for (i = 0, chan_first = 0; i < kbuf_chans; chan_first += kbuf_chan_leds[i], i++) {
+    if (first >= chan_first + kbuf_chan_leds[i] || last <= chan_first) {
+      continue;
+    }
+    tx_end[i] = max(tx_end[i], min(last - chan_first, kbuf_chan_leds[i]));
+  }
+}
+
+
+size_t kbuf_encode(char *dst, int idx, const char *buf, size_t len) {
+  int i;
+  unsigned long stop, chan_first, threshold = READ_ONCE(encode_threshold);
+  size_t pixels = 0, count = 0, span = 0;
+  unsigned long *dirty = kbuf_dirty[idx];
+  u64 t;
+  // only send the frame up to the last changed pixel on any channel
+  for (i = 0; i < kbuf_chans; i++) {
+    pixels = max(pixels, tx_end[i]);
+  }
+  // nothing changed since the last frame so the LEDs are already up to date
+  if (!pixels) {
+    return 0;
+  }
+  // packed symbols are sent in whole groups of pixels so no pixel gets only part of its bits
+  pixels = min(roundup(pixels, group_len), max(kbuf_chan_leds[0], kbuf_chan_leds[1]));
+  // re-encode only the runs of pixels that changed since this buffer was last sent
+  // (changes past the end of this frame stay marked until they are sent)
+  t = ktime_get_ns();
+  trace_ws281x_encode_begin(idx, len);
+  for (i = 0, chan_first = 0; i < NUM_CHANS; chan_first += kbuf_chan_leds[i], i++) {
+    stop = min_t(unsigned long, chan_first + min(kbuf_chan_leds[i], pixels), len / pixel_len);
+    kbuf_job.stop[i] = max(stop, chan_first);
+    kbuf_job.chunks[i] = DIV_ROUND_UP(kbuf_job.stop[i] - chan_first, KBUF_CHUNK_LEN);
+    span += kbuf_job.stop[i] - chan_first;
+  }
+  if (threshold && span >= threshold && num_online_cpus() > 1) {
+    // large frames are split into chunks that every online CPU encodes at the same time
+    kbuf_job.dst = dst;
+    kbuf_job.buf = buf;
+    kbuf_job.dirty = dirty;
+    count = kbuf_encode_parallel();
+  } else {
+    for (i = 0, chan_first = 0; i < kbuf_chans; chan_first += kbuf_chan_leds[i], i++) {
+      count += kbuf_encode_dirty(dst, buf, dirty, i, chan_first, kbuf_job.stop[i], chan_first + kbuf_chan_leds[i]);
+    }
+  }
+  for (i = 0, chan_first = 0; i < kbuf_chans; chan_first += kbuf_chan_leds[i], i++) {
+    bitmap_clear(dirty, chan_first, kbuf_job.stop[i] - chan_first);
+  }
+  stats_encode(count * pixel_len, ktime_get_ns() - t);
+  len = encoder_words(pixels) * ENCODER_WORD_LEN * kbuf_chans;
+  trace_ws281x_encode_end(idx, count * pixel_len, len);
+  return len;
+}
+
+
+void kbuf_encode_frame(char *dst, const char *buf) {
+  int i;
+  for (i = 0; i < kbuf_chans; i++) {
+    kbuf_encode_run(dst, buf, i, 0, kbuf_chan_leds[i]);
+  }
+}
+
+
+void kbuf_sent(void) {
+  int i;
+  stats_frame();
+  for (i = 0; i < NUM_CHANS; i++) {
+    tx_end[i] = 0;
+  }
+}
+
+
+void kbuf_cleanup(void) {
+  int i;
+  if (kbuf_wq) {
+    destroy_workqueue(kbuf_wq);
+    kbuf_wq = NULL;
+  }
+  kfree(kbuf_workers);
+  kbuf_workers = NULL;
+  for (i = 0; i < NUM_KBUFS; i++) {
+    kfree(kbuf_dirty[i]);
+    kbuf_dirty[i] = NULL;
+  }
+  // there is nothing left to invalidate or send until the strips are laid out again
+  kbuf_frame_len = 0;
+  kbuf_len = 0;
+}
@@ -13,36 +13,110 @@
 #include <linux/init.h>        /* for __init/exit */
 
 #include <fs.h>                /* for fs interface */
+#include <pacer.h>             /* for PACER_MAX_DEPTH */
+#include <frame.h>             /* for the pixel buffer */
+#include <stats.h>             /* for performance counters */
 #include <WS281x.h>            /* for MODULE_* macros and num_leds */
+#include <WS281x_ioctl.h>      /* for WS281x_FMT_* and WS281x_MAX_LEDS */
 
 /* module mutex */
 struct mutex ws281x_mutex;
 
 /*
- * module parameter registration
+ * module parameter registration (the strip layout can be read back from sysfs since it can be
+ * changed at runtime with ioctls)
  */
 int num_leds;
-module_param(num_leds, int, 0);
+module_param(num_leds, int, 0444);
 MODULE_PARM_DESC(num_leds, " Number of WS281x LEDs to control");
 int pin_num;
-module_param(pin_num, int, 0);
+module_param(pin_num, int, 0444);
 MODULE_PARM_DESC(pin_num, " GPIO pin to set as the PWM output");
 int pin_fun;
-module_param(pin_fun, int, 0);
+module_param(pin_fun, int, 0444);
 MODULE_PARM_DESC(pin_fun, " GPIO pin alternate function");
+int num_leds2;
+module_param(num_leds2, int, 0444);
+MODULE_PARM_DESC(num_leds2, " Number of WS281x LEDs on the second strip (0 to disable it)");
+int pin_num2;
+module_param(pin_num2, int, 0444);
+MODULE_PARM_DESC(pin_num2, " GPIO pin to set as the second PWM channel output");
+int pin_fun2;
+module_param(pin_fun2, int, 0444);
+MODULE_PARM_DESC(pin_fun2, " GPIO pin alternate function for the second PWM channel");
+int dma_irq;
+module_param(dma_irq, int, 0);
+MODULE_PARM_DESC(dma_irq, " DMA completion interrupt number (0 to look it up in the device tree)");
+int refresh_hz;
+module_param(refresh_hz, int, 0);
+MODULE_PARM_DESC(refresh_hz, " Fixed refresh rate for queued frames (0 to render frames as soon as they are written)");
+int queue_policy;
+module_param(queue_policy, int, 0);
+MODULE_PARM_DESC(queue_policy, " Pending frame policy with refresh_hz (0 to queue every frame, 1 to keep only the latest)");
+int queue_depth = 4;
+module_param(queue_depth, int, 0);
+MODULE_PARM_DESC(queue_depth, " Number of frames that can be pending with refresh_hz");
+int pixel_format = WS281x_FMT_GRB;
+module_param(pixel_format, int, 0444);
+MODULE_PARM_DESC(pixel_format, " Pixel format of the written pixel data (0 RGB, 1 GRB, 2 BGR, 3 RGBW, 4 GRBW, 5 RGB16, 6 RGBW16)");
+int wire_format = WS281x_FMT_GRB;
+module_param(wire_format, int, 0444);
+MODULE_PARM_DESC(wire_format, " Component order of the LEDs (0 RGB, 1 GRB, 2 BGR, 3 RGBW, 4 GRBW)");
+int symbol_bits = 4;
+module_param(symbol_bits, int, 0444);
+MODULE_PARM_DESC(symbol_bits, " PWM slots per data bit (4 at 3.2MHz or 3 at 2.4MHz for 25% smaller DMA buffers)");
+int encode_threshold = 4096;
+module_param(encode_threshold, int, 0644);
+MODULE_PARM_DESC(encode_threshold, " Number of pixels from which a frame is encoded on every online CPU (0 to always encode on one CPU)");
 
 /*
  * module initialization routine
  */
 static int __init init(void) {
+  int err;
   printk(KERN_INFO "%s: (init) initializing with %d WS281x LEDs on GPIO %d\n", DRIVER_NAME, num_leds, pin_num);
   // check the value of num_leds
-  if (num_leds <= 0) {
+  if (num_leds <= 0 || num_leds > WS281x_MAX_LEDS) {
     printk(KERN_ALERT "%s: (init) invalid number of WS281x LEDs %d\n", DRIVER_NAME, num_leds);
     return -1;
   }
+  // check the value of num_leds2
+  if (num_leds2 < 0 || num_leds2 > WS281x_MAX_LEDS) {
+    printk(KERN_ALERT "%s: (init) invalid number of WS281x LEDs on the second strip %d\n", DRIVER_NAME, num_leds2);
+    return -1;
+  }
+  // check the frame pacing parameters
+  if (refresh_hz < 0 || queue_depth <= 0 || queue_depth > PACER_MAX_DEPTH) {
+    printk(KERN_ALERT "%s: (init) invalid refresh rate %d or queue depth %d\n", DRIVER_NAME, refresh_hz, queue_depth);
+    return -1;
+  }
+  // check the symbol length
+  if (symbol_bits != 3 && symbol_bits != 4) {
+    printk(KERN_ALERT "%s: (init) invalid number of PWM slots per bit %d\n", DRIVER_NAME, symbol_bits);
+    return -1;
+  }
+  // check the parallel encode threshold
+  if (encode_threshold < 0) {
+    printk(KERN_ALERT "%s: (init) invalid parallel encode threshold %d\n", DRIVER_NAME, encode_threshold);
+    return -1;
+  }
   mutex_init(&ws281x_mutex);
-  return init_fs();
+  err = stats_init();
+  if (err) {
+    return err;
+  }
+  err = frame_init();
+  if (err) {
+    stats_cleanup();
+    return err;
+  }
+  err = init_fs();
+  if (err) {
+    frame_cleanup();
+    stats_cleanup();
+    return err;
+  }
+  return 0;
 }
 
 
@@ -52,6 +126,8 @@ static int __init init(void) {
 static void __exit cleanup(void) {
   printk(KERN_INFO "%s: (cleanup) uninitializing...\n", DRIVER_NAME);
   cleanup_fs();
+  frame_cleanup();
+  stats_cleanup();
   mutex_destroy(&ws281x_mutex);
 }
 
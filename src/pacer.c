@@ -0,0 +1,231 @@
+/*
+ * pacer.c
+ *
+ * Ring of pending frames that are rendered at a fixed refresh rate by an hrtimer
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h>    /* for printk KERN_INFO */
+#include <linux/hrtimer.h>   /* for the refresh timer */
+#include <linux/ktime.h>     /* for ktime_set() */
+#include <linux/workqueue.h> /* for rendering outside of interrupt context */
+#include <linux/wait.h>      /* for wait queues */
+#include <linux/vmalloc.h>   /* for vmalloc() */
+#include <linux/string.h>    /* for memcpy() */
+#include <asm/errno.h>       /* for linux error return codes */
+
+#include <pacer.h>           /* for interface definition */
+#include <frame.h>           /* for frame_tick() */
+#include <stats.h>           /* for performance counters */
+#include <WS281x.h>          /* for WS281x macros and user parameters */
+#include <WS281x_ioctl.h>    /* for WS281x_POLICY_* */
+
+/* ring of pending frames */
+static char *ring;
+static size_t ring_size;
+static size_t ring_frame_len;
+static unsigned int ring_head;
+static unsigned int ring_count;
+
+/* current refresh rate and pending frame policy */
+static unsigned int pacer_hz;
+static unsigned int pacer_policy;
+
+/* refresh timer and the work it queues to render the next frame */
+static struct hrtimer pacer_timer;
+static struct workqueue_struct *pacer_wq;
+static struct work_struct pacer_work;
+static int pacer_running;
+
+/* wait queue for writers waiting for room in the ring */
+static DECLARE_WAIT_QUEUE_HEAD(pacer_waitq);
+
+
+/*
+ * renders the next pending frame (runs on the pacer workqueue)
+ */
+static void pacer_work_fn(struct work_struct *work) {
+  frame_tick();
+  // a frame may have left the ring
+  wake_up_interruptible(&pacer_waitq);
+}
+
+
+/*
+ * refresh timer callback. rendering sleeps so it is deferred to the workqueue. if the previous
+ * tick is still rendering this tick is skipped.
+ */
+static enum hrtimer_restart pacer_timer_fn(struct hrtimer *timer) {
+  unsigned int hz = READ_ONCE(pacer_hz);
+  // pacing was turned off while the timer was armed
+  if (!hz) {
+    return HRTIMER_NORESTART;
+  }
+  if (!queue_work(pacer_wq, &pacer_work)) {
+    stats_late_tick();
+  }
+  hrtimer_forward_now(timer, ktime_set(0, NSEC_PER_SEC / hz));
+  return HRTIMER_RESTART;
+}
+
+
+int pacer_init(size_t frame_len) {
+  int err;
+  ring_frame_len = frame_len;
+  pacer_wq = alloc_workqueue("%s", WQ_HIGHPRI, 1, DRIVER_NAME);
+  if (!pacer_wq) {
+    printk(KERN_ALERT "%s: (pacer_init) alloc_workqueue error\n", DRIVER_NAME);
+    return -ENOMEM;
+  }
+  INIT_WORK(&pacer_work, pacer_work_fn);
+  hrtimer_init(&pacer_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  pacer_timer.function = pacer_timer_fn;
+  // the ring for all depths is allocated up front
+  ring_size = queue_depth * ring_frame_len;
+  ring = (char *)vmalloc(ring_size);
+  if (!ring) {
+    printk(KERN_ALERT "%s: (pacer_init) vmalloc error\n", DRIVER_NAME);
+    destroy_workqueue(pacer_wq);
+    return -ENOMEM;
+  }
+  err = pacer_configure(refresh_hz, queue_policy);
+  if (err) {
+    printk(KERN_ALERT "%s: (pacer_init) invalid refresh rate %d or policy %d\n", DRIVER_NAME, refresh_hz, queue_policy);
+    vfree(ring);
+    destroy_workqueue(pacer_wq);
+    return err;
+  }
+  return 0;
+}
+
+
+void pacer_start(void) {
+  if (pacer_hz && !pacer_running) {
+    pacer_running = 1;
+    hrtimer_start(&pacer_timer, ktime_set(0, NSEC_PER_SEC / pacer_hz), HRTIMER_MODE_REL);
+  }
+}
+
+
+void pacer_stop(void) {
+  if (pacer_running) {
+    hrtimer_cancel(&pacer_timer);
+    cancel_work_sync(&pacer_work);
+    pacer_running = 0;
+  }
+  // frames that were never rendered are not carried over, and writers waiting for room in the
+  // ring are woken since no tick may come to make room
+  pacer_drop();
+}
+
+
+int pacer_configure(unsigned int hz, unsigned int policy) {
+  if (hz > PACER_MAX_HZ || (policy != WS281x_POLICY_QUEUE && policy != WS281x_POLICY_LATEST)) {
+    return -EINVAL;
+  }
+  WRITE_ONCE(pacer_hz, hz);
+  pacer_policy = policy;
+  // drop anything still pending and release blocked writers
+  pacer_drop();
+  return 0;
+}
+
+
+int pacer_resize(size_t frame_len) {
+  char *buf;
+  // the ring only ever grows so going back to a previous frame length can not fail
+  if (queue_depth * frame_len > ring_size) {
+    buf = (char *)vmalloc(queue_depth * frame_len);
+    if (!buf) {
+      printk(KERN_ALERT "%s: (pacer_resize) vmalloc error\n", DRIVER_NAME);
+      return -ENOMEM;
+    }
+    vfree(ring);
+    ring = buf;
+    ring_size = queue_depth * frame_len;
+  }
+  ring_frame_len = frame_len;
+  // pending frames have the old length
+  stats_dropped(ring_count);
+  ring_head = 0;
+  ring_count = 0;
+  return 0;
+}
+
+
+int pacer_enabled(void) {
+  return pacer_hz != 0;
+}
+
+
+int pacer_room(void) {
+  return !pacer_hz || pacer_policy == WS281x_POLICY_LATEST || READ_ONCE(ring_count) < queue_depth;
+}
+
+
+int pacer_wait_room(void) {
+  return wait_event_interruptible(pacer_waitq, pacer_room());
+}
+
+
+void pacer_poll_wait(struct file *filep, poll_table *wait) {
+  poll_wait(filep, &pacer_waitq, wait);
+}
+
+
+int pacer_push(const char *frame) {
+  unsigned int slot;
+  if (pacer_policy == WS281x_POLICY_LATEST && ring_count) {
+    // latest wins: coalesce into the frame that is still pending
+    slot = (ring_head + ring_count - 1) % queue_depth;
+    stats_coalesced();
+  } else {
+    if (ring_count >= queue_depth) {
+      return -EAGAIN;
+    }
+    slot = (ring_head + ring_count) % queue_depth;
+    ring_count++;
+  }
+  memcpy(ring + (slot * ring_frame_len), frame, ring_frame_len);
+  return 0;
+}
+
+
+void pacer_push_over(const char *frame) {
+  unsigned int slot;
+  if (ring_count < queue_depth) {
+    pacer_push(frame);
+    return;
+  }
+  slot = (ring_head + ring_count - 1) % queue_depth;
+  stats_coalesced();
+  memcpy(ring + (slot * ring_frame_len), frame, ring_frame_len);
+}
+
+
+const char *pacer_pop(void) {
+  const char *frame;
+  if (!ring_count) {
+    return NULL;
+  }
+  frame = ring + (ring_head * ring_frame_len);
+  ring_head = (ring_head + 1) % queue_depth;
+  ring_count--;
+  return frame;
+}
+
+
+void pacer_drop(void) {
+  stats_dropped(ring_count);
+  ring_head = 0;
+  ring_count = 0;
+  wake_up_interruptible(&pacer_waitq);
+}
+
+
+void pacer_cleanup(void) {
+  pacer_stop();
+  destroy_workqueue(pacer_wq);
+  vfree(ring);
+}
@@ -0,0 +1,192 @@
+/*
+ * stats.c
+ *
+ * Runtime performance counters of the driver, readable from debugfs while the module is loaded:
+ *
+ * /sys/kernel/debug/ws281x/stats
+ *
+ * Aaron Reyes
+ */
+
+#include <linux/kernel.h>   /* for printk KERN_INFO */
+#include <linux/spinlock.h> /* for the counter lock */
+#include <linux/ktime.h>    /* for ktime_get_ns() */
+#include <linux/seq_file.h> /* for seq_printf() */
+#include <linux/debugfs.h>  /* for debugfs_create_dir() */
+#include <linux/string.h>   /* for memcpy() */
+#include <linux/log2.h>     /* for ilog2() */
+#include <asm/errno.h>      /* for linux error return codes */
+
+#include <stats.h>          /* for interface definition */
+#include <WS281x.h>         /* for WS281x macros */
+
+/* names of the transfer error causes in the stats file */
+static const char *const dma_error_names[STATS_DMA_ERRORS] = {
+  "read_last_not_set", "fifo", "read", "timeout"
+};
+
+/* all of the counters, protected by stats_lock (also taken from the refresh timer) */
+struct stats {
+  u64 frames;
+  u64 encodes;
+  u64 encode_bytes;
+  u64 encode_ns;
+  u64 encode_max_ns;
+  u64 wait_ns;
+  u64 wait_max_ns;
+  u64 dma_errors[STATS_DMA_ERRORS];
+  u64 dropped;
+  u64 coalesced;
+  u64 late_ticks;
+  u64 interval_hist[STATS_HIST_BUCKETS];
+  u64 last_frame_ns;
+};
+
+static struct stats stats;
+static DEFINE_SPINLOCK(stats_lock);
+
+static struct dentry *debug_dir;
+
+
+/*
+ * prints all of the counters as "name value" lines
+ */
+static int stats_show(struct seq_file *m, void *v) {
+  struct stats s;
+  unsigned long flags;
+  int i;
+  // take a consistent snapshot so printing never holds the lock
+  spin_lock_irqsave(&stats_lock, flags);
+  memcpy(&s, &stats, sizeof(s));
+  spin_unlock_irqrestore(&stats_lock, flags);
+  seq_printf(m, "frames %llu\n", s.frames);
+  seq_printf(m, "encodes %llu\n", s.encodes);
+  seq_printf(m, "encode_bytes %llu\n", s.encode_bytes);
+  seq_printf(m, "encode_ns %llu\n", s.encode_ns);
+  seq_printf(m, "encode_max_ns %llu\n", s.encode_max_ns);
+  seq_printf(m, "wait_ns %llu\n", s.wait_ns);
+  seq_printf(m, "wait_max_ns %llu\n", s.wait_max_ns);
+  for (i = 0; i < STATS_DMA_ERRORS; i++) {
+    seq_printf(m, "dma_error_%s %llu\n", dma_error_names[i], s.dma_errors[i]);
+  }
+  seq_printf(m, "dropped %llu\n", s.dropped);
+  seq_printf(m, "coalesced %llu\n", s.coalesced);
+  seq_printf(m, "late_ticks %llu\n", s.late_ticks);
+  // bucket i counts intervals of [2^i, 2^(i+1)) us, the last one everything longer
+  for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+    seq_printf(m, "interval_us_%u %llu\n", 1U << i, s.interval_hist[i]);
+  }
+  return 0;
+}
+
+
+static int stats_open(struct inode *inode, struct file *filep) {
+  return single_open(filep, stats_show, NULL);
+}
+
+
+static const struct file_operations stats_fops = {
+  .owner = THIS_MODULE,
+  .open = stats_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+
+int stats_init(void) {
+  memset(&stats, 0, sizeof(stats));
+  debug_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+  if (IS_ERR_OR_NULL(debug_dir)) {
+    // debugfs is optional, the driver works without its counters being visible
+    printk(KERN_INFO "%s: (stats_init) debugfs not available\n", DRIVER_NAME);
+    debug_dir = NULL;
+    return 0;
+  }
+  debugfs_create_file("stats", 0444, debug_dir, NULL, &stats_fops);
+  return 0;
+}
+
+
+struct dentry *stats_debugfs_dir(void) {
+  return debug_dir;
+}
+
+
+void stats_encode(size_t bytes, u64 ns) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.encodes++;
+  stats.encode_bytes += bytes;
+  stats.encode_ns += ns;
+  if (ns > stats.encode_max_ns) {
+    stats.encode_max_ns = ns;
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_wait(u64 ns) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.wait_ns += ns;
+  if (ns > stats.wait_max_ns) {
+    stats.wait_max_ns = ns;
+  }
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_frame(void) {
+  u64 now = ktime_get_ns();
+  u64 us;
+  int bucket;
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  if (stats.frames) {
+    us = div_u64(now - stats.last_frame_ns, NSEC_PER_USEC);
+    bucket = us ? ilog2(us) : 0;
+    stats.interval_hist[min(bucket, STATS_HIST_BUCKETS - 1)]++;
+  }
+  stats.frames++;
+  stats.last_frame_ns = now;
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_dma_error(enum stats_dma_error cause) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.dma_errors[cause]++;
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_dropped(unsigned int frames) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.dropped += frames;
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_coalesced(void) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.coalesced++;
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_late_tick(void) {
+  unsigned long flags;
+  spin_lock_irqsave(&stats_lock, flags);
+  stats.late_ticks++;
+  spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+
+void stats_cleanup(void) {
+  debugfs_remove_recursive(debug_dir);
+  debug_dir = NULL;
+}
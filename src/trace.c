@@ -0,0 +1,10 @@
+/*
+ * trace.c
+ *
+ * Instantiates the tracepoints declared in WS281x_trace.h
+ *
+ * Aaron Reyes
+ */
+
+#define CREATE_TRACE_POINTS
+#include <WS281x_trace.h> /* for the tracepoint definitions */